@@ -21,14 +21,109 @@ va_is_dirty(void *va)
     return (vpt[PPN(va)] & PTE_D) != 0;
 }
 
+// Read or write nsecs sectors starting at secno, using the IDE disk
+// on the host and the host file system when running as a guest.
+    static int
+bc_disk_read(uint32_t secno, void *dst, size_t nsecs)
+{
+#ifndef VMM_GUEST
+    return ide_read(secno, dst, nsecs);
+#else
+    return host_read(secno, dst, nsecs);
+#endif
+}
+
+    static int
+bc_disk_write(uint32_t secno, const void *src, size_t nsecs)
+{
+#ifndef VMM_GUEST
+    return ide_write(secno, src, nsecs);
+#else
+    return host_write(secno, src, nsecs);
+#endif
+}
+
+// Number of blocks faulted into the cache, for the dirty ratio.
+static uint32_t bc_ncached;
+
+static void wb_forget(uint32_t blockno);
+
+// --------------------------------------------------------------
+// Sequential readahead
+// --------------------------------------------------------------
+
+// We keep a handful of readahead streams.  A stream remembers the
+// block just past the last run it read in; a fault on exactly that
+// block means someone is walking the disk sequentially, so the next
+// run is read ahead with a window that doubles on every hit, up to
+// the largest transfer a single IDE command can do.  Any other fault
+// starts a new stream (replacing the least recently used one) with
+// no readahead at all, so random access pays nothing extra.
+#define RA_NSTREAM	4
+#define RA_MINWIN	2			// first readahead, in blocks
+#define RA_MAXWIN	(256 / BLKSECTS)	// max blocks per ide_read
+
+struct ra_stream {
+    uint32_t ra_next;	// block expected to fault next
+    uint32_t ra_win;	// current readahead window in blocks
+    uint32_t ra_lru;	// last use, for replacement
+};
+
+static struct ra_stream ra_streams[RA_NSTREAM];
+static uint32_t ra_clock;
+
+// Find the stream that expected a fault at blockno, or recycle the
+// least recently used one.  Returns the number of blocks (including
+// blockno itself) that the caller should try to read in one go.
+    static uint32_t
+ra_lookup(uint32_t blockno)
+{
+    struct ra_stream *s, *victim = &ra_streams[0];
+    uint32_t n;
+
+    ra_clock++;
+    for (s = ra_streams; s < ra_streams + RA_NSTREAM; s++) {
+        if (s->ra_win && s->ra_next == blockno) {
+            s->ra_win = MIN(s->ra_win * 2, RA_MAXWIN);
+            s->ra_lru = ra_clock;
+            return s->ra_win;
+        }
+        if (s->ra_lru < victim->ra_lru)
+            victim = s;
+    }
+
+    // A miss: only read the faulting block, but remember where a
+    // sequential reader would fault next.
+    victim->ra_next = blockno + 1;
+    victim->ra_win = RA_MINWIN / 2;
+    victim->ra_lru = ra_clock;
+    return 1;
+}
+
+// Record that [blockno, blockno + n) is now in the cache, so the
+// stream that asked for it expects the next fault right after it.
+    static void
+ra_advance(uint32_t blockno, uint32_t n)
+{
+    struct ra_stream *s;
+
+    for (s = ra_streams; s < ra_streams + RA_NSTREAM; s++)
+        if (s->ra_lru == ra_clock) {
+            s->ra_next = blockno + n;
+            return;
+        }
+}
+
 // Fault any disk block that is read or written in to memory by
-// loading it from disk.
-// Hint: Use ide_read and BLKSECTS.
+// loading it from disk.  When the fault continues a sequential
+// stream, the following unmapped blocks are read in as well, with a
+// single multi-sector ide_read into the contiguous DISKMAP range.
     static void
 bc_pgfault(struct UTrapframe *utf)
 {
     void *addr = (void *) utf->utf_fault_va;
     uint64_t blockno = ((uint64_t)addr - DISKMAP) / BLKSIZE;
+    uint32_t i, n;
     int r;
 
     // Check that the fault was within the block cache region
@@ -40,29 +135,44 @@ bc_pgfault(struct UTrapframe *utf)
     if (super && blockno >= super->s_nblocks)
         panic("reading non-existent block %08x\n", blockno);
 
-    // Allocate a page in the disk map region, read the contents
-    // of the block from the disk into that page, and mark the
-    // page not-dirty (since reading the data from disk will mark
-    // the page dirty).
-    //
-    // LAB 5: Your code here
-    r = sys_page_alloc(0, ROUNDDOWN(addr, PGSIZE), PTE_SYSCALL);
-    if(r < 0) {
-        panic("%s:%d %s() %e at addr %x", __FILE__, __LINE__, __func__, r, addr);
+    // Decide how far to read ahead.  Stop at the end of the disk and
+    // at the first block that is already cached, so we never clobber
+    // a (possibly dirty) cached block.  Before the superblock is
+    // mapped we don't know the disk size, so read just one block.
+    n = super ? ra_lookup(blockno) : 1;
+    if (super)
+        n = MIN(n, super->s_nblocks - blockno);
+    for (i = 1; i < n; i++)
+        if (va_is_mapped(diskaddr(blockno + i)))
+            break;
+    n = i;
+
+    // Allocate pages in the disk map region, read the contents of
+    // the blocks from the disk into those pages, and mark the pages
+    // not-dirty (since reading the data from disk will mark the
+    // pages dirty).
+    addr = ROUNDDOWN(addr, BLKSIZE);
+    for (i = 0; i < n; i++) {
+        r = sys_page_alloc(0, addr + i * BLKSIZE, PTE_SYSCALL);
+        if(r < 0) {
+            panic("%s:%d %s() %e at addr %x", __FILE__, __LINE__, __func__, r, addr);
+        }
     }
-#ifndef VMM_GUEST
-    r = ide_read(blockno*BLKSECTS, ROUNDDOWN(addr,BLKSIZE), BLKSECTS);
-#else
-    r = host_read(blockno*BLKSECTS, ROUNDDOWN(addr,BLKSIZE), BLKSECTS);
-#endif
+
+    r = bc_disk_read(blockno*BLKSECTS, addr, n*BLKSECTS);
     if(r < 0) {
         panic("%s:%d %s() %e at addr %x", __FILE__, __LINE__, __func__, r, addr);
     }
 
-    r = sys_page_map(0, ROUNDDOWN(addr, PGSIZE), 0, ROUNDDOWN(addr, BLKSIZE), PTE_P | PTE_U | PTE_W);
-    if(r < 0) {
-        panic("%s:%d %s() %e at addr %x", __FILE__, __LINE__, __func__, r, addr);
+    for (i = 0; i < n; i++) {
+        r = sys_page_map(0, addr + i * BLKSIZE, 0, addr + i * BLKSIZE, PTE_P | PTE_U | PTE_W);
+        if(r < 0) {
+            panic("%s:%d %s() %e at addr %x", __FILE__, __LINE__, __func__, r, addr);
+        }
     }
+    if (super)
+        ra_advance(blockno, n);
+    bc_ncached += n;
 
     // Check that the block we read was allocated. (exercise for
     // the reader: why do we do this *after* reading the block
@@ -88,12 +198,9 @@ flush_block(void *addr)
 
     // LAB 5: Your code here.
     if((va_is_mapped(addr)) && (va_is_dirty(addr))) {
-#ifndef VMM_GUEST
-        ide_write(blockno*BLKSECTS, ROUNDDOWN(addr,BLKSIZE), BLKSECTS);
-#else
-        host_write(blockno*BLKSECTS, ROUNDDOWN(addr, BLKSIZE), BLKSECTS);
-#endif
+        bc_disk_write(blockno*BLKSECTS, ROUNDDOWN(addr,BLKSIZE), BLKSECTS);
     }
+    wb_forget(blockno);
 
     if((va_is_mapped(addr))) {
         int r = sys_page_map(0, ROUNDDOWN(addr,PGSIZE), 0, ROUNDDOWN(addr,PGSIZE), PTE_SYSCALL&~PTE_D);
@@ -103,6 +210,190 @@ flush_block(void *addr)
     }
 }
 
+// --------------------------------------------------------------
+// Write-back
+// --------------------------------------------------------------
+
+// Blocks that have been written to are recorded in wb_dirty, a bitmap
+// indexed by block number, so walking it from wb_lo to wb_hi visits the
+// dirty blocks in disk order.  The flusher turns each run of adjacent
+// dirty blocks into a single multi-sector write and queues it on the
+// IDE driver without waiting; bc_sync is the barrier that waits for
+// everything queued so far.
+//
+// Writing back starts once the oldest recorded block has been dirty for
+// wb_dirty_age ms, or once wb_dirty_ratio percent of the cached blocks
+// are dirty.  The FS server has no timer, so the check runs after every
+// request (see serve), which is the only time blocks get dirtied.
+#define WB_DIRTY_AGE	1000			// default, in ms
+#define WB_DIRTY_RATIO	10			// default, in percent
+#define WB_MAXRUN	(256 / BLKSECTS)	// max blocks per ide_write
+#define WB_NREQ		16			// writes in flight at once
+
+static uint32_t wb_dirty[DISKSIZE / BLKSIZE / 32];
+static uint32_t wb_lo = ~0U, wb_hi;	// bounds of the set bits
+static uint32_t wb_ndirty;
+static uint32_t wb_since;		// when the set became non-empty
+
+static uint32_t wb_dirty_age = WB_DIRTY_AGE;
+static uint32_t wb_dirty_ratio = WB_DIRTY_RATIO;
+
+#ifndef VMM_GUEST
+static struct ide_req wb_reqs[WB_NREQ];
+static int wb_nextreq;
+static int wb_error;		// first failed write since the last bc_sync
+#endif
+
+// Set the write-back thresholds.  An age of 0 flushes after every
+// request; a ratio of 0 disables the ratio check.
+    void
+bc_set_writeback(uint32_t age_ms, uint32_t ratio)
+{
+    wb_dirty_age = age_ms;
+    wb_dirty_ratio = ratio;
+}
+
+// Record that the block containing addr has been (or is about to be)
+// modified, so the flusher will write it back.
+    void
+bc_mark_dirty(void *addr)
+{
+    uint32_t blockno = ((uint64_t)addr - DISKMAP) / BLKSIZE;
+
+    if (addr < (void*)DISKMAP || addr >= (void*)(DISKMAP + DISKSIZE))
+        panic("bc_mark_dirty of bad va %08x", addr);
+
+    if (wb_dirty[blockno / 32] & (1 << (blockno % 32)))
+        return;
+    wb_dirty[blockno / 32] |= 1 << (blockno % 32);
+    if (wb_ndirty++ == 0)
+        wb_since = sys_time_msec();
+    wb_lo = MIN(wb_lo, blockno);
+    wb_hi = MAX(wb_hi, blockno);
+}
+
+    static void
+wb_forget(uint32_t blockno)
+{
+    if (!(wb_dirty[blockno / 32] & (1 << (blockno % 32))))
+        return;
+    wb_dirty[blockno / 32] &= ~(1 << (blockno % 32));
+    if (--wb_ndirty == 0) {
+        wb_lo = ~0U;
+        wb_hi = 0;
+    }
+}
+
+#ifndef VMM_GUEST
+// Note the result of a finished write-back request, once.
+    static void
+wb_reap(struct ide_req *req)
+{
+    if (req->result < 0 && !wb_error)
+        wb_error = req->result;
+    req->result = 0;
+}
+#endif
+
+// Queue one write of blocks [blockno, blockno + n), which are all
+// mapped, and mark them clean.  PTE_D is cleared before the write is
+// issued: we are single-threaded, so nothing touches the blocks until
+// we return to the request loop, and anything written after that sets
+// PTE_D again and is picked up by a later flush.
+    static void
+wb_write_run(uint32_t blockno, uint32_t n)
+{
+    void *addr = diskaddr(blockno);
+    uint32_t i;
+    int r;
+
+#ifndef VMM_GUEST
+    struct ide_req *req = &wb_reqs[wb_nextreq];
+
+    wb_nextreq = (wb_nextreq + 1) % WB_NREQ;
+    while (req->result == IDE_BUSY)
+        ide_complete();
+    wb_reap(req);
+    req->secno = blockno * BLKSECTS;
+    req->buf = addr;
+    req->nsecs = n * BLKSECTS;
+    req->write = 1;
+    ide_submit(req);
+#else
+    if ((r = host_write(blockno * BLKSECTS, addr, n * BLKSECTS)) < 0)
+        panic("%s:%d %s() %e at block %08x", __FILE__, __LINE__, __func__, r, blockno);
+#endif
+
+    for (i = 0; i < n; i++) {
+        r = sys_page_map(0, addr + i * BLKSIZE, 0, addr + i * BLKSIZE, PTE_SYSCALL&~PTE_D);
+        if(r < 0) {
+            panic("%s:%d %s() %e at addr %x", __FILE__, __LINE__, __func__, r, addr);
+        }
+    }
+}
+
+// Write back every recorded block, coalescing adjacent dirty blocks.
+// Blocks that are no longer mapped or dirty are just dropped.
+    void
+bc_flush_dirty(void)
+{
+    uint32_t b, start, n, hi = wb_hi;
+
+    start = n = 0;
+    for (b = wb_lo; wb_ndirty && b <= hi; b++) {
+        if (!(wb_dirty[b / 32] & (1 << (b % 32)))) {
+            if (b % 32 == 0 && wb_dirty[b / 32] == 0)
+                b += 31;
+            continue;
+        }
+        wb_forget(b);
+        if (!va_is_mapped(diskaddr(b)) || !va_is_dirty(diskaddr(b)))
+            continue;
+        if (n && (start + n != b || n == WB_MAXRUN)) {
+            wb_write_run(start, n);
+            n = 0;
+        }
+        if (!n)
+            start = b;
+        n++;
+    }
+    if (n)
+        wb_write_run(start, n);
+}
+
+// Write back everything recorded so far and wait until it is on disk.
+// Returns the first write-back error since the last bc_sync, or 0.
+    int
+bc_sync(void)
+{
+#ifndef VMM_GUEST
+    int i, r;
+
+    bc_flush_dirty();
+    ide_drain();
+    for (i = 0; i < WB_NREQ; i++)
+        wb_reap(&wb_reqs[i]);
+    r = wb_error;
+    wb_error = 0;
+    return r;
+#else
+    bc_flush_dirty();
+    return 0;
+#endif
+}
+
+// Called between requests: start write-back if the oldest dirty block
+// is too old or too much of the cache is dirty.
+    void
+bc_writeback_tick(void)
+{
+    if (wb_ndirty == 0)
+        return;
+    if (sys_time_msec() - wb_since >= wb_dirty_age
+        || (wb_dirty_ratio && wb_ndirty * 100 >= wb_dirty_ratio * bc_ncached))
+        bc_flush_dirty();
+}
+
 // Test that the block cache works, by smashing the superblock and
 // reading it back.
     static void
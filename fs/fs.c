@@ -43,11 +43,11 @@ free_block(uint32_t blockno)
     if (blockno == 0)
         panic("attempt to free zero block");
     bitmap[blockno/32] |= 1<<(blockno%32);
+    bc_mark_dirty(&bitmap[blockno/32]);
 }
 
-// Search the bitmap for a free block and allocate it.  When you
-// allocate a block, immediately flush the changed bitmap block
-// to disk.
+// Search the bitmap for a free block and allocate it.  The changed
+// bitmap block is handed to the write-back flusher.
 //
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
@@ -65,7 +65,7 @@ alloc_block(void)
     for(i = 3; i < super->s_nblocks; i++){
     	if(block_is_free(i)){
     		bitmap[i/32] &= ~(1 << (i%32));
-    		flush_block(bitmap);
+    		bc_mark_dirty(&bitmap[i/32]);
     		return i;
     	}
     }
@@ -109,6 +109,7 @@ fs_init(void)
         ide_set_disk(1);
     else
         ide_set_disk(0);
+    ide_dma_init();
 #else
     host_ipc_init();
 #endif
@@ -163,7 +164,10 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
 				if (r < 0)
 					return r;
 
+				memset(diskaddr(r), 0, BLKSIZE);
+				bc_mark_dirty(diskaddr(r));
 				f->f_indirect = r;
+				bc_mark_dirty(f);
 			}
 			else
 				return -E_NOT_FOUND;
@@ -194,10 +198,13 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
 	if ((r = file_block_walk(f, filebno, &ppdiskbno, true)) < 0)
 		return r;
 	if (*ppdiskbno == 0) {
-		uint32_t blknum = alloc_block();
+		int blknum = alloc_block();
 		if (blknum < 0)
 			return -E_NO_DISK;
 		*ppdiskbno = blknum;
+		// The pointer lives in the File or in the indirect block;
+		// either way the flusher must write it with the data.
+		bc_mark_dirty(ppdiskbno);
 	}
 
 	*blk = (char*)diskaddr(*ppdiskbno);
@@ -206,6 +213,22 @@ return 0;
 	panic("file_get_block not implemented");
 }
 
+// Like file_get_block, but never allocates: returns -E_NOT_FOUND if
+// the block is a hole in the file.
+int
+file_find_block(struct File *f, uint32_t filebno, char **blk)
+{
+	uint32_t *ppdiskbno;
+	int r;
+
+	if ((r = file_block_walk(f, filebno, &ppdiskbno, false)) < 0)
+		return r;
+	if (*ppdiskbno == 0)
+		return -E_NOT_FOUND;
+	*blk = (char*)diskaddr(*ppdiskbno);
+	return 0;
+}
+
 
 // Try to find a file named "name" in dir.  If so, set *file to it.
 //
@@ -403,16 +426,19 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
     off_t pos;
     char *blk;
 
-    // Extend file if necessary
-    if (offset + count > f->f_size)
-        if ((r = file_set_size(f, offset + count)) < 0)
-            return r;
+    // Extend file if necessary.  Unlike file_set_size, leave the
+    // metadata write to the flusher; appends are the common case.
+    if (offset + count > f->f_size) {
+        f->f_size = offset + count;
+        bc_mark_dirty(f);
+    }
 
     for (pos = offset; pos < offset + count; ) {
         if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
             return r;
         bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
         memmove(blk + pos % BLKSIZE, buf, bn);
+        bc_mark_dirty(blk);
         pos += bn;
         buf += bn;
     }
@@ -433,6 +459,7 @@ file_free_block(struct File *f, uint32_t filebno)
     if (*ptr) {
         free_block(*ptr);
         *ptr = 0;
+        bc_mark_dirty(ptr);
     }
     return 0;
 }
@@ -476,9 +503,9 @@ file_set_size(struct File *f, off_t newsize)
 }
 
 // Flush the contents and metadata of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// Loop over all the blocks in file, hand every dirty one to the
+// write-back flusher, and start writing.  The writes are queued, not
+// waited for; use fs_sync for that.
     void
 file_flush(struct File *f)
 {
@@ -489,11 +516,13 @@ file_flush(struct File *f)
         if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
                 pdiskbno == NULL || *pdiskbno == 0)
             continue;
-        flush_block(diskaddr(*pdiskbno));
+        if (va_is_mapped(diskaddr(*pdiskbno)) && va_is_dirty(diskaddr(*pdiskbno)))
+            bc_mark_dirty(diskaddr(*pdiskbno));
     }
-    flush_block(f);
+    bc_mark_dirty(f);
     if (f->f_indirect)
-        flush_block(diskaddr(f->f_indirect));
+        bc_mark_dirty(diskaddr(f->f_indirect));
+    bc_flush_dirty();
 }
 
 // Remove a file by truncating it and then zeroing the name.
@@ -514,12 +543,17 @@ file_remove(const char *path)
     return 0;
 }
 
-// Sync the entire file system.  A big hammer.
-    void
+// Sync the entire file system.  A big hammer: every dirty block in the
+// cache is written, whether or not the flusher knew about it, and we
+// return only once all queued writes have reached the disk.  Returns
+// < 0 if any write-back since the last sync failed.
+    int
 fs_sync(void)
 {
     int i;
     for (i = 1; i < super->s_nblocks; i++)
-        flush_block(diskaddr(i));
+        if (va_is_mapped(diskaddr(i)) && va_is_dirty(diskaddr(i)))
+            bc_mark_dirty(diskaddr(i));
+    return bc_sync();
 }
 
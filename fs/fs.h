@@ -15,8 +15,23 @@ struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
 /* ide.c */
+#define IDE_BUSY	1		// ide_req.result while in flight
+
+struct ide_req {
+	uint32_t secno;
+	void *buf;
+	size_t nsecs;
+	bool write;
+	int result;			// IDE_BUSY, then 0 or < 0
+	struct ide_req *next;
+};
+
 bool ide_probe_disk1(void);
 void ide_set_disk(int diskno);
+void ide_dma_init(void);
+void ide_submit(struct ide_req *req);
+struct ide_req *ide_complete(void);
+void ide_drain(void);
 int ide_read(uint32_t secno, void *dst, size_t nsecs);
 int ide_write(uint32_t secno, const void *src, size_t nsecs);
 
@@ -25,11 +40,17 @@ void* diskaddr(uint64_t blockno);
 bool va_is_mapped(void *va);
 bool va_is_dirty(void *va);
 void flush_block(void *addr);
+void bc_mark_dirty(void *addr);
+void bc_flush_dirty(void);
+int bc_sync(void);
+void bc_writeback_tick(void);
+void bc_set_writeback(uint32_t age_ms, uint32_t ratio);
 void bc_init(void);
 
 /* fs.c */
 void fs_init(void);
 int file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
+int file_find_block(struct File *f, uint32_t file_blockno, char **pblk);
 int file_create(const char *path, struct File **f);
 int file_open(const char *path, struct File **f);
 ssize_t file_read(struct File *f, void *buf, size_t count, off_t offset);
@@ -37,7 +58,7 @@ int file_write(struct File *f, const void *buf, size_t count, off_t offset);
 int file_set_size(struct File *f, off_t newsize);
 void file_flush(struct File *f);
 int file_remove(const char *path);
-void fs_sync(void);
+int fs_sync(void);
 
 /* int	map_block(uint32_t); */
 bool block_is_free(uint32_t blockno);
@@ -1,5 +1,8 @@
 /*
- * Minimal PIO-based (non-interrupt-driven) IDE driver code.
+ * IDE driver code.  Transfers go through the PIIX bus-master DMA engine
+ * when the kernel found one, and fall back to polled PIO otherwise (or
+ * after a DMA error).  DMA completion is signalled by IRQ 14, which the
+ * kernel turns into a wakeup of this env via sys_ide_wait_intr.
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
  */
@@ -12,8 +15,40 @@
 #define IDE_DF		0x20
 #define IDE_ERR		0x01
 
+// Bus-master IDE registers, relative to the BAR 4 I/O base.
+#define BM_CMD		0x0
+#define BM_STATUS	0x2
+#define BM_PRDT		0x4
+
+#define BM_CMD_START	0x01
+#define BM_CMD_READ	0x08	// bus master writes to memory
+#define BM_ST_ACTIVE	0x01
+#define BM_ST_ERR	0x02
+#define BM_ST_INTR	0x04
+
+// Physical region descriptor table, one page in our address space.
+#define PRDVA		0x0fffe000
+#define PRD_EOT		0x8000
+#define PRD_MAX		(PGSIZE / sizeof(struct ide_prd))
+
+struct ide_prd {
+    uint32_t prd_addr;
+    uint16_t prd_len;
+    uint16_t prd_flags;
+};
+
 static int diskno = 1;
 
+// Bus-master I/O base, or 0 when only PIO is available.
+static int bmbase;
+static struct ide_prd *prdt = (struct ide_prd *) PRDVA;
+
+// Outstanding requests, in submission order.  The head is the one the
+// controller is working on.
+static struct ide_req *ide_qhead, *ide_qtail;
+
+static int ide_pio(uint32_t secno, void *buf, size_t nsecs, bool write);
+
     static int
 ide_wait_ready(bool check_error)
 {
@@ -59,13 +94,9 @@ ide_set_disk(int d)
     diskno = d;
 }
 
-    int
-ide_read(uint32_t secno, void *dst, size_t nsecs)
+    static void
+ide_select(uint32_t secno, size_t nsecs)
 {
-    int r;
-
-    assert(nsecs <= 256);
-
     ide_wait_ready(0);
 
     outb(0x1F2, nsecs);
@@ -73,6 +104,189 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
     outb(0x1F4, (secno >> 8) & 0xFF);
     outb(0x1F5, (secno >> 16) & 0xFF);
     outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
+}
+
+// Ask the kernel for the bus-master controller and set up the PRD table.
+// Leaves bmbase 0 (PIO only) if anything is missing.
+    void
+ide_dma_init(void)
+{
+    int r;
+
+    if ((r = sys_ide_dma_attach()) < 0) {
+        cprintf("ide: no DMA controller (%e), using PIO\n", r);
+        return;
+    }
+    if ((r = sys_page_alloc(0, prdt, PTE_P|PTE_U|PTE_W)) < 0)
+        panic("%s:%d %s() %e while allocating PRD table",
+                __FILE__, __LINE__, __func__, r);
+    if (PTE_ADDR(vpt[VPN(prdt)]) >= 0x100000000ULL) {
+        cprintf("ide: PRD table above 4GB, using PIO\n");
+        return;
+    }
+
+    // Clear nIEN so the drive raises IRQ 14 on completion.
+    outb(0x3F6, 0);
+    bmbase = r;
+}
+
+// Fill the PRD table for [buf, buf + nsecs*SECTSIZE).  Every entry stays
+// inside one page, so none crosses a 64K boundary.  Returns -E_INVAL if
+// some page is unmapped or not reachable with 32-bit addresses.
+    static int
+ide_build_prdt(void *buf, size_t nsecs)
+{
+    uintptr_t va = (uintptr_t) buf;
+    size_t len = nsecs * SECTSIZE, n, i;
+    physaddr_t pa;
+
+    for (i = 0; len > 0; i++, va += n, len -= n) {
+        if (i == PRD_MAX || !va_is_mapped((void *) va))
+            return -E_INVAL;
+        pa = PTE_ADDR(vpt[VPN(va)]) + PGOFF(va);
+        if (pa >= 0x100000000ULL)
+            return -E_INVAL;
+        n = MIN(len, PGSIZE - PGOFF(va));
+        prdt[i].prd_addr = pa;
+        prdt[i].prd_len = n;
+        prdt[i].prd_flags = 0;
+    }
+    prdt[i - 1].prd_flags = PRD_EOT;
+    return 0;
+}
+
+// Program the controller for the request at the head of the queue.
+// If DMA cannot be used for it, do it synchronously with PIO instead.
+    static void
+ide_start(struct ide_req *req)
+{
+    uint8_t dir = req->write ? 0 : BM_CMD_READ;
+
+    if (!bmbase || ide_build_prdt(req->buf, req->nsecs) < 0) {
+        req->result = ide_pio(req->secno, req->buf, req->nsecs, req->write);
+        return;
+    }
+
+    outb(bmbase + BM_CMD, 0);
+    outl(bmbase + BM_PRDT, PTE_ADDR(vpt[VPN(prdt)]));
+    outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    outb(bmbase + BM_CMD, dir);
+
+    ide_select(req->secno, req->nsecs);
+    outb(0x1F7, req->write ? 0xCA : 0xC8);	// WRITE DMA / READ DMA
+
+    outb(bmbase + BM_CMD, dir | BM_CMD_START);
+}
+
+// Wait for the head request to finish and record its result.  A failed
+// DMA transfer is retried with PIO and turns DMA off from then on.
+    static void
+ide_finish(struct ide_req *req)
+{
+    uint8_t bmst, st;
+
+    if (req->result != IDE_BUSY)
+        return;
+
+    while (!((bmst = inb(bmbase + BM_STATUS)) & BM_ST_INTR))
+        sys_ide_wait_intr();
+
+    outb(bmbase + BM_CMD, 0);
+    st = inb(0x1F7);	// also acknowledges the drive's interrupt
+    outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+
+    if ((bmst & BM_ST_ERR) || (st & (IDE_BSY|IDE_DF|IDE_ERR))) {
+        cprintf("ide: DMA error (bm %x, status %x), falling back to PIO\n",
+                bmst, st);
+        bmbase = 0;
+        outb(0x3F6, 0x02);	// nIEN: PIO polls, no interrupts wanted
+        req->result = ide_pio(req->secno, req->buf, req->nsecs, req->write);
+        return;
+    }
+    req->result = 0;
+}
+
+// Queue a transfer.  It is started at once if the controller is idle,
+// otherwise when the requests ahead of it complete.  req->result stays
+// IDE_BUSY until the request is done.
+    void
+ide_submit(struct ide_req *req)
+{
+    assert(req->nsecs > 0 && req->nsecs <= 256);
+
+    req->result = IDE_BUSY;
+    req->next = 0;
+    if (ide_qtail)
+        ide_qtail->next = req;
+    else
+        ide_qhead = req;
+    ide_qtail = req;
+
+    if (ide_qhead == req)
+        ide_start(req);
+}
+
+// Complete the oldest outstanding request, start the next one, and
+// return the completed request (0 if the queue was empty).
+    struct ide_req *
+ide_complete(void)
+{
+    struct ide_req *req = ide_qhead;
+
+    if (!req)
+        return 0;
+    ide_finish(req);
+
+    if (!(ide_qhead = req->next))
+        ide_qtail = 0;
+    else
+        ide_start(ide_qhead);
+    return req;
+}
+
+// Wait until every queued request has completed.
+    void
+ide_drain(void)
+{
+    while (ide_complete())
+        /* do nothing */;
+}
+
+    static int
+ide_sync(uint32_t secno, void *buf, size_t nsecs, bool write)
+{
+    struct ide_req req;
+
+    req.secno = secno;
+    req.buf = buf;
+    req.nsecs = nsecs;
+    req.write = write;
+    ide_submit(&req);
+    while (req.result == IDE_BUSY)
+        ide_complete();
+    return req.result;
+}
+
+    int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+    return ide_sync(secno, dst, nsecs, 0);
+}
+
+    int
+ide_write(uint32_t secno, const void *src, size_t nsecs)
+{
+    return ide_sync(secno, (void *) src, nsecs, 1);
+}
+
+    static int
+ide_pio_read(uint32_t secno, void *dst, size_t nsecs)
+{
+    int r;
+
+    assert(nsecs <= 256);
+
+    ide_select(secno, nsecs);
     outb(0x1F7, 0x20);	// CMD 0x20 means read sector
 
     for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
@@ -84,20 +298,14 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
     return 0;
 }
 
-    int
-ide_write(uint32_t secno, const void *src, size_t nsecs)
+    static int
+ide_pio_write(uint32_t secno, const void *src, size_t nsecs)
 {
     int r;
 
     assert(nsecs <= 256);
 
-    ide_wait_ready(0);
-
-    outb(0x1F2, nsecs);
-    outb(0x1F3, secno & 0xFF);
-    outb(0x1F4, (secno >> 8) & 0xFF);
-    outb(0x1F5, (secno >> 16) & 0xFF);
-    outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
+    ide_select(secno, nsecs);
     outb(0x1F7, 0x30);	// CMD 0x30 means write sector
 
     for (; nsecs > 0; nsecs--, src += SECTSIZE) {
@@ -109,3 +317,9 @@ ide_write(uint32_t secno, const void *src, size_t nsecs)
     return 0;
 }
 
+    static int
+ide_pio(uint32_t secno, void *buf, size_t nsecs, bool write)
+{
+    return write ? ide_pio_write(secno, buf, nsecs)
+                 : ide_pio_read(secno, buf, nsecs);
+}
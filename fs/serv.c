@@ -259,6 +259,50 @@ serve_write(envid_t envid, struct Fsreq_write *req)
 	return numBytesWritten;
     panic("serve_write not implemented");
 }
+// Share the block-cache pages holding req->req_npages blocks (at most
+// IPC_MAXPAGES) of req->req_fileid, starting at byte req->req_offset,
+// with the caller, read-only, without copying.  The pages are put in
+// *iv for a vector IPC reply.  The offset must be block-aligned.
+// Returns the number of valid file bytes in the pages (0 at or past end
+// of file, in which case no page is sent), or < 0 on error.  The pages
+// stay shared with the cache, so the caller sees later writes to the
+// blocks; bytes past the returned count are not file data.  Holes in
+// the file are sent as a shared page of zeros rather than allocated,
+// so later writes there aren't seen.
+    int
+serve_map(envid_t envid, struct Fsreq_map *req, struct Ipcv *iv)
+{
+    static char zeroblk[BLKSIZE] __attribute__((aligned(PGSIZE)));
+    struct OpenFile *o;
+    off_t off, end;
+    char *blk;
+    int r;
+
+    if (debug)
+        cprintf("serve_map %08x %08x %08x\n", envid, req->req_fileid, req->req_offset);
+
+    if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+        return r;
+    if ((o->o_mode & O_ACCMODE) == O_WRONLY)
+        return -E_INVAL;
+    if (req->req_offset < 0 || req->req_offset % BLKSIZE)
+        return -E_INVAL;
+    if (req->req_npages < 1)
+        return -E_INVAL;
+
+    end = MIN(o->o_file->f_size,
+            req->req_offset + MIN(req->req_npages, IPC_MAXPAGES) * BLKSIZE);
+    for (off = req->req_offset; off < end; off += BLKSIZE) {
+        if ((r = file_find_block(o->o_file, off / BLKSIZE, &blk)) == -E_NOT_FOUND)
+            blk = zeroblk;
+        else if (r < 0)
+            return r;
+        iv->iv_pages[iv->iv_npages++] = blk;
+    }
+    iv->iv_perm = PTE_P|PTE_U;
+    return MAX(end - req->req_offset, 0);
+}
+
    int
 serve_stat(envid_t envid, union Fsipc *ipc)
 {
@@ -316,12 +360,13 @@ serve_remove(envid_t envid, struct Fsreq_remove *req)
     return file_remove(path);
 }
 
-// Sync the file system.
+// Sync the file system.  This is a barrier: all writes queued by the
+// flusher, and every other dirty block, are on disk when it returns,
+// unless it fails with the error of a write that didn't make it.
     int
 serve_sync(envid_t envid, union Fsipc *req)
 {
-    fs_sync();
-    return 0;
+    return fs_sync();
 }
 
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
@@ -337,12 +382,139 @@ fshandler handlers[] = {
 };
 #define NHANDLERS (sizeof(handlers)/sizeof(handlers[0]))
 
+// Request rings.  Each client may set up one ring (see inc/fs.h), kept
+// at RINGVA + slot * FSRING_NPAGES * PGSIZE in our address space.  Like
+// the open-file table, a slot is free again once the client has
+// unmapped the ring (or died): its control page's refcount drops to 1.
+#define MAXRING		32
+#define RINGVA		0xD8000000
+
+struct ClientRing {
+    envid_t cr_env;		// client owning this ring
+    uint32_t cr_head;	// our copy of fr_sq_head; the client can't touch it
+    struct Fsring *cr_ring;
+};
+
+struct ClientRing ringtab[MAXRING];
+
+    static void *
+ring_page(struct ClientRing *cr, int i)
+{
+    return (char *) cr->cr_ring + i * PGSIZE;
+}
+
+    static bool
+ring_live(struct ClientRing *cr)
+{
+    return cr->cr_ring && pageref(cr->cr_ring) > 1;
+}
+
+    static struct ClientRing *
+ring_lookup(envid_t envid)
+{
+    int i;
+
+    for (i = 0; i < MAXRING; i++)
+        if (ringtab[i].cr_env == envid && ring_live(&ringtab[i]))
+            return &ringtab[i];
+    return 0;
+}
+
+// Run the requests queued on cr, in order.  At most one ring's worth is
+// run per call, so a client can't keep us here by refilling the ring.
+// Returns the number of requests run.
+    static int
+ring_drain(struct ClientRing *cr)
+{
+    struct Fsring *fr = cr->cr_ring;
+    struct Fsring_ent *fe;
+    uint32_t tail = fr->fr_sq_tail;
+    int n, slot;
+
+    for (n = 0; cr->cr_head != tail && n < FSRING_NENT; n++) {
+        slot = cr->cr_head % FSRING_NENT;
+        fe = &fr->fr_ent[slot];
+        if (fe->fe_type >= 0 && fe->fe_type < NHANDLERS && handlers[fe->fe_type])
+            fe->fe_result = handlers[fe->fe_type](cr->cr_env, ring_page(cr, 1 + slot));
+        else
+            fe->fe_result = -E_INVAL;
+        fr->fr_sq_head = ++cr->cr_head;
+    }
+    return n;
+}
+
+// Return page req->req_page of the caller's ring, shared and writable.
+// Asking for page 0 sets up a fresh ring, replacing any old one.
+    int
+serve_ring(envid_t envid, struct Fsreq_ring *req,
+        void **pg_store, int *perm_store)
+{
+    struct ClientRing *cr;
+    int i, r;
+
+    if (debug)
+        cprintf("serve_ring %08x %d\n", envid, req->req_page);
+
+    if (req->req_page < 0 || req->req_page >= FSRING_NPAGES)
+        return -E_INVAL;
+
+    cr = ring_lookup(envid);
+    if (req->req_page == 0) {
+        if (!cr)
+            for (i = 0; i < MAXRING; i++)
+                if (!ring_live(&ringtab[i])) {
+                    cr = &ringtab[i];
+                    break;
+                }
+        if (!cr)
+            return -E_MAX_OPEN;
+        cr->cr_ring = (struct Fsring *) (RINGVA + (cr - ringtab) * FSRING_NPAGES * PGSIZE);
+        if ((r = sys_page_alloc(0, cr->cr_ring, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+            return r;
+        cr->cr_env = envid;
+        cr->cr_head = 0;
+    } else if (!cr)
+        return -E_INVAL;
+    else if ((r = sys_page_alloc(0, ring_page(cr, req->req_page),
+                                 PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+        return r;
+
+    // PTE_SHARE, so fork leaves the caller's ring shared with us rather
+    // than copy-on-write.  A child sets up a ring of its own.
+    *pg_store = ring_page(cr, req->req_page);
+    *perm_store = PTE_P|PTE_U|PTE_W|PTE_SHARE;
+    return 0;
+}
+
+// Run everything on the caller's ring.  Returns the number of requests run.
+    int
+serve_ring_kick(envid_t envid, union Fsipc *req)
+{
+    struct ClientRing *cr;
+
+    if (!(cr = ring_lookup(envid)))
+        return -E_INVAL;
+    return ring_drain(cr);
+}
+
+// Pick up requests clients queued without telling us.
+    static void
+ring_poll(void)
+{
+    int i;
+
+    for (i = 0; i < MAXRING; i++)
+        if (ring_live(&ringtab[i]))
+            ring_drain(&ringtab[i]);
+}
+
     void
 serve(void)
 {
     uint32_t req, whom;
     int perm, r;
     void *pg;
+    struct Ipcv mapv;
 
     while (1) {
         perm = 0;
@@ -361,6 +533,17 @@ serve(void)
         pg = NULL;
         if (req == FSREQ_OPEN) {
             r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+        } else if (req == FSREQ_MAP) {
+            memset(&mapv, 0, sizeof(mapv));
+            mapv.iv_value = r = serve_map(whom, (struct Fsreq_map*)fsreq, &mapv);
+            if (r < 0)
+                mapv.iv_npages = 0;
+            ipc_sendv(whom, &mapv);
+            goto sent;
+        } else if (req == FSREQ_RING) {
+            r = serve_ring(whom, (struct Fsreq_ring*)fsreq, &pg, &perm);
+        } else if (req == FSREQ_RING_KICK) {
+            r = serve_ring_kick(whom, fsreq);
         } else if (req < NHANDLERS && handlers[req]) {
             r = handlers[req](whom, fsreq);
         } else {
@@ -368,9 +551,15 @@ serve(void)
             r = -E_INVAL;
         }
         ipc_send(whom, r, pg, perm);
+sent:
         if(debug)
             cprintf("FS: Sent response %d to %x\n", r, whom);
         sys_page_unmap(0, fsreq);
+
+        ring_poll();
+
+        // Start background write-back if enough has piled up.
+        bc_writeback_tick();
     }
 }
 
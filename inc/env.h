@@ -40,6 +40,20 @@ enum {
     ENV_NOT_RUNNABLE
 };
 
+// Vector IPC (sys_ipc_sendv/sys_ipc_recvv) moves up to IPC_MAXPAGES
+// page mappings plus IPC_INLINE bytes of inline data in one message.
+#define IPC_MAXPAGES		16
+#define IPC_INLINE		64
+
+struct Ipcv {
+    uint32_t iv_value;			// the ordinary IPC value
+    int iv_perm;			// perm for every page sent
+    uint32_t iv_npages;			// entries used in iv_pages
+    void *iv_pages[IPC_MAXPAGES];	// page-aligned VAs to send, any order
+    uint32_t iv_len;			// bytes used in iv_inline
+    uint8_t iv_inline[IPC_INLINE];
+};
+
 // Special environment types
 enum EnvType {
     ENV_TYPE_USER = 0,
@@ -73,6 +87,38 @@ struct Env {
     uint32_t env_ipc_value;		// Data value sent to us
     envid_t env_ipc_from;		// envid of the sender
     int env_ipc_perm;		// Perm of page mapping received
+    uint32_t env_ipc_window;	// Pages we can take at env_ipc_dstva
+    uint32_t env_ipc_npages;	// Pages received, mapped from env_ipc_dstva up
+    uint32_t env_ipc_len;		// Inline bytes received
+    uint8_t env_ipc_inline[IPC_INLINE];	// Inline data received
+
+    // Blocking sends (sys_ipc_send).  Senders waiting for this env to
+    // receive hang off env_ipc_sendq in FIFO order; while queued, a
+    // sender keeps its message in the env_ipc_send_* fields.
+    struct Env *env_ipc_sendq;		// first sender waiting on us
+    struct Env *env_ipc_sendq_next;	// next sender on the same queue
+    envid_t env_ipc_send_to;		// env we are queued on, 0 if none
+    uint32_t env_ipc_send_value;
+    void *env_ipc_send_srcva;
+    int env_ipc_send_perm;
+    bool env_ipc_send_call;		// then receive, as sys_ipc_call
+    bool env_ipc_send_vec;		// message is a struct Ipcv (sys_ipc_sendv)
+    uint32_t env_ipc_send_deadline;	// time_msec() to give up at, 0 = never
+
+    // Alarm (sys_ipc_alarm): a message to ourselves at a set time
+    uint32_t env_ipc_alarm;		// time_msec() to deliver at, 0 = unarmed
+    uint32_t env_ipc_alarm_value;	// value to deliver
+
+    // Futex wait (sys_futex_wait)
+    physaddr_t env_futex_pa;		// word waited on, 0 if not waiting
+    uint32_t env_futex_deadline;	// time_msec() to give up at, 0 = never
+    struct Env *env_futex_next;		// next waiter
+
+    // TLB tagging (kern/pmap.c pcid_switch).  env_pcid is valid on CPU
+    // env_pcid_cpu while that CPU's PCID generation is env_pcid_gen.
+    uint16_t env_pcid;
+    int env_pcid_cpu;
+    uint64_t env_pcid_gen;		// 0 = no PCID yet
     uint8_t *elf;
     struct VmxGuestInfo env_vmxinfo;
 };
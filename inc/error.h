@@ -35,6 +35,8 @@ enum {
     E_VMCS_INIT = 20, // Couldn't init the VMCS region
     E_NO_ENT = 21,
 
+	E_IPC_TIMEOUT	= 22,	// Blocking send timed out
+
 	MAXERROR
 };
 
@@ -50,6 +50,10 @@ struct Stat {
 	struct Dev *st_dev;
 };
 
+// Each fd has this many pages of data area starting at fd2data(fd),
+// which devices can use if they choose.
+#define FDDATAPAGES	16
+
 char*	fd2data(struct Fd *fd);
 uint64_t	fd2num(struct Fd *fd);
 int	fd_alloc(struct Fd **fd_store);
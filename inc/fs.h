@@ -70,7 +70,15 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Map shares up to req_npages block-cache pages read-only with
+	// the caller in one vector IPC and returns the number of valid
+	// bytes in them
+	FSREQ_MAP,
+	// Ring returns page req_page of the caller's request ring
+	FSREQ_RING,
+	// Ring_kick runs every request queued on the caller's ring
+	FSREQ_RING_KICK
 };
 
 union Fsipc {
@@ -108,9 +116,39 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_map {
+		int req_fileid;
+		off_t req_offset;
+		int req_npages;
+	} map;
+	struct Fsreq_ring {
+		int req_page;
+	} ring;
 
 	// Ensure Fsipc is one page
 	char _pad[PGSIZE];
 };
 
+// Per-client request ring, shared between a client and the file server.
+// Page 0 holds a struct Fsring; page 1 + i is the union Fsipc for slot i,
+// laid out exactly as for the IPC request of the same type.  The client
+// fills a slot and advances fr_sq_tail; the server runs slots in order,
+// stores each result in fe_result (and any reply in the slot's page) and
+// advances fr_sq_head.  Slots between the client's own reap index and
+// fr_sq_head are complete.  Only the requests in the server's handler
+// table may be queued (not FSREQ_OPEN, FSREQ_MAP or the ring requests).
+#define FSRING_NENT	16
+#define FSRING_NPAGES	(1 + FSRING_NENT)
+
+struct Fsring_ent {
+	int fe_type;			// FSREQ_*
+	int fe_result;			// the value the IPC would have returned
+};
+
+struct Fsring {
+	volatile uint32_t fr_sq_head;	// next slot the server will run
+	volatile uint32_t fr_sq_tail;	// next slot the client will fill
+	struct Fsring_ent fr_ent[FSRING_NENT];
+};
+
 #endif /* !JOS_INC_FS_H */
@@ -51,6 +51,7 @@ envid_t	sys_getenvid(void);
 int	sys_env_destroy(envid_t);
 void	sys_yield(void);
 static envid_t sys_exofork(void);
+envid_t	sys_fork_cow(void);
 int	sys_env_set_status(envid_t env, int status);
 int	sys_env_set_trapframe(envid_t env, struct Trapframe *tf);
 int	sys_env_set_pgfault_upcall(envid_t env, void *upcall);
@@ -58,13 +59,23 @@ int	sys_page_alloc(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
+int	sys_page_prezero(int n);
 int	sys_ipc_try_send(envid_t to_env, uint64_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_call(envid_t to_env, uint64_t value, void *pg, int perm, void *rcv_pg);
+int	sys_ipc_send(envid_t to_env, uint64_t value, void *pg, int perm, unsigned timeout);
+int	sys_ipc_sendv(envid_t to_env, const struct Ipcv *iv, unsigned timeout);
+int	sys_ipc_recvv(void *rcv_pg, unsigned npages);
+int	sys_ipc_alarm(unsigned deadline, uint32_t value);
+int	sys_futex_wait(volatile uint32_t *uaddr, uint32_t val, unsigned timeout);
+int	sys_futex_wake(volatile uint32_t *uaddr, unsigned n);
 unsigned int sys_time_msec(void);
 int sys_ept_map(envid_t srcenvid, void *srcva, envid_t guest, void* guest_pa, int perm);
 envid_t sys_env_mkguest(uint64_t gphysz, uint64_t gRIP);
 int	sys_env_transmit_packet(envid_t envid, const char* data, size_t len);
 int	sys_env_receive_packet(envid_t envid, char* data, size_t *len);
+int	sys_ide_dma_attach(void);
+int	sys_ide_wait_intr(void);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t __attribute__((always_inline))
@@ -81,7 +92,13 @@ sys_exofork(void)
 
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	ipc_send_timeout(envid_t to_env, uint32_t value, void *pg, int perm, unsigned timeout);
+void	ipc_sendv(envid_t to_env, const struct Ipcv *iv);
+int32_t ipc_recvv(envid_t *from_env_store, void *pg, unsigned npages,
+		 unsigned *npages_store, int *perm_store);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		 void *rcv_pg, envid_t *from_env_store, int *perm_store);
 envid_t	ipc_find_env(enum EnvType type);
 
 #ifdef VMM_GUEST
@@ -90,7 +107,6 @@ int32_t ipc_host_recv(void *pg);
 #endif
 
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
 envid_t	sfork(void);	// Challenge!
 
@@ -110,6 +126,12 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	mmap(void *va, size_t len, int fd, off_t offset);
+int	munmap(void *va, size_t len);
+int	fsring_read(int fd, void *buf, size_t n);
+int	fsring_write(int fd, const void *buf, size_t n);
+int	fsring_stat(int fd, struct Stat *st);
+int	fsring_reap(int *ticket);
 
 // pageref.c
 int	pageref(void *addr);
@@ -121,6 +143,8 @@ int     shutdown(int s, int how);
 int     connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     listen(int s, int backlog);
 int     socket(int domain, int type, int protocol);
+int     poll(struct pollfd *fds, int nfds, int timeout);
+ssize_t sendfile(int s, int fdnum, off_t offset, size_t len);
 
 // nsipc.c
 int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -131,7 +155,10 @@ int     nsipc_connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *buf, int size, unsigned int flags);
+int     nsipc_sendfile(int s, const void *buf, int size, unsigned int flags);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_poll(struct pollfd *fds, int nfds, int timeout);
+int     nsipc_stats(struct Nsret_stats *st);
 
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
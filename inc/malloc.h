@@ -3,10 +3,25 @@
 
 void *malloc(size_t size);
 void free(void *addr);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *addr, size_t size);
 
 enum
 {
     MAXMALLOC = 8 * 1024*1024	/* max size of one allocated chunk */
 };
 
+// Per-thread cache of freed small objects, by size class.
+// See malloc_set_cache.
+#define MCACHE_NCLASS	13
+#define MCACHE_DEPTH	8
+
+struct malloc_cache {
+    uint8_t mc_n[MCACHE_NCLASS];
+    void *mc_obj[MCACHE_NCLASS][MCACHE_DEPTH];
+};
+
+void malloc_set_cache(struct malloc_cache *(*get)(void));
+void malloc_cache_flush(struct malloc_cache *mc);
+
 #endif
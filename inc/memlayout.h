@@ -192,12 +192,23 @@ struct Page {
 	// Next page on the free list.
         struct Page *pp_link;
 
+	// Previous block on a buddy allocator free list.
+	struct Page *pp_prev;
+
 	// pp_ref is the count of pointers (usually in page table entries)
 	// to this page, for pages allocated using page_alloc.
 	// Pages allocated at boot time using pmap.c's
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// PP_* flags (kern/pmap.h): whether the page is free, and whether
+	// it is part of a multi-page block such as a 2MB superpage.
+	uint16_t pp_flags;
+
+	// log2 of the number of pages in the page's buddy block, for free
+	// blocks and for pages from page_alloc_order.
+	uint16_t pp_order;
 };
 
 #endif /* !__ASSEMBLER__ */
@@ -84,6 +84,11 @@
 // hardware, so user processes are allowed to set them arbitrarily.
 #define PTE_AVAIL	0xE00	// Available for software use
 
+// Software bits the user-level fork and spawn code, and sys_fork_cow,
+// agree on.
+#define PTE_SHARE	0x400	// shared, not copied, by fork and spawn
+#define PTE_COW		0x800	// copy-on-write
+
 // Flags in PTE_SYSCALL may be used only in system calls. (Others may not.)
 #define PTE_SYSCALL (PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
@@ -114,6 +119,21 @@
 #define CR4_PVI		0x00000002	// Protected-Mode Virtual Interrupts
 #define CR4_VME		0x00000001	// V86 Mode Extensions
 #define CR4_VMXE    0x00002000  // VMX 
+#define CR4_PCIDE   0x00020000  // Process-context identifiers
+
+// With CR4_PCIDE, the low 12 bits of CR3 are the PCID tagging new TLB
+// entries, and loading CR3 with CR3_NOFLUSH keeps that PCID's entries.
+#define CR3_PCID_MASK	0xFFFULL
+#define CR3_NOFLUSH	(1ULL << 63)
+
+// INVPCID types
+#define INVPCID_ADDR	0	// one address in one PCID
+#define INVPCID_PCID	1	// everything in one PCID
+#define INVPCID_ALL	2	// everything, global entries too
+
+// CPUID feature bits
+#define CPUID_1_ECX_PCID	(1 << 17)
+#define CPUID_7_EBX_INVPCID	(1 << 10)
 
 //x86_64 related changes
 #define CR4_PAE     0x00000020
@@ -6,12 +6,133 @@
 #include <inc/types.h>
 #include <inc/mmu.h>
 #include <lwip/sockets.h>
+#include <lwip/stats.h>
 
 struct jif_pkt {
 	int jp_len;
 	char jp_data[0];
 };
 
+// Packet rings, shared between the network server and its input and
+// output helpers.  A ring is a control page followed by PKTRING_NSLOT
+// slots of PKTRING_SLOTSZ bytes, each holding one struct jif_pkt.  The
+// producer fills slot pr_tail and then advances pr_tail; the consumer
+// takes slot pr_next, and advances pr_head past the slots it is done
+// with.  Slots between pr_head and pr_next are still the consumer's,
+// which may give them back in any order (pktring_release).  A
+// consumer about to sleep sets pr_wait, and the producer that next
+// advances pr_tail clears it and wakes the consumer (see pktring_arm).
+#define PKTRING_SLOTSZ	2048
+#define PKTRING_NSLOT	64
+#define PKTRING_NPAGES	(1 + PKTRING_NSLOT * PKTRING_SLOTSZ / PGSIZE)
+#define PKTRING_MAXLEN	(PKTRING_SLOTSZ - sizeof(struct jif_pkt))
+
+struct Pktring {
+	volatile uint32_t pr_head;	// next slot to give back
+	volatile uint32_t pr_tail;	// next slot to fill
+	volatile uint32_t pr_wait;	// consumer wants a wakeup
+	uint32_t pr_next;		// next slot to take (consumer only)
+	uint8_t pr_held[PKTRING_NSLOT];	// taken, not yet released (ditto)
+};
+
+// Frames from the input helper to the NS, and from the NS to the
+// output helper.
+#define INRINGVA	((struct Pktring *) 0x30000000)
+#define OUTRINGVA	((struct Pktring *) (0x30000000 + PKTRING_NPAGES * PGSIZE))
+
+static inline struct jif_pkt *
+pktring_slot(struct Pktring *r, uint32_t i)
+{
+	return (struct jif_pkt *) ((char *) r + PGSIZE
+				   + (i % PKTRING_NSLOT) * PKTRING_SLOTSZ);
+}
+
+// The slot to fill next, or 0 if the ring is full.
+static inline struct jif_pkt *
+pktring_free_slot(struct Pktring *r)
+{
+	if (r->pr_tail - r->pr_head == PKTRING_NSLOT)
+		return 0;
+	return pktring_slot(r, r->pr_tail);
+}
+
+// Hand the slot from pktring_free_slot to the consumer.  Returns 1 if
+// the consumer asked to be woken, and so must be.
+static inline bool
+pktring_produce(struct Pktring *r)
+{
+	__sync_synchronize();
+	r->pr_tail++;
+	__sync_synchronize();
+	if (!r->pr_wait)
+		return 0;
+	r->pr_wait = 0;
+	return 1;
+}
+
+// The slot to take next, or 0 if the ring is empty.
+static inline struct jif_pkt *
+pktring_peek(struct Pktring *r)
+{
+	if (r->pr_next == r->pr_tail)
+		return 0;
+	__sync_synchronize();
+	return pktring_slot(r, r->pr_next);
+}
+
+// Take the slot from pktring_peek.  It stays the consumer's until
+// passed to pktring_release.
+static inline void
+pktring_take(struct Pktring *r)
+{
+	r->pr_held[r->pr_next % PKTRING_NSLOT] = 1;
+	r->pr_next++;
+}
+
+// Release a taken slot.  The producer gets slots back in ring order,
+// so this one waits for any taken before it.
+static inline void
+pktring_release(struct Pktring *r, struct jif_pkt *pkt)
+{
+	r->pr_held[((char *) pkt - (char *) r - PGSIZE) / PKTRING_SLOTSZ] = 0;
+	__sync_synchronize();
+	while (r->pr_head != r->pr_next && !r->pr_held[r->pr_head % PKTRING_NSLOT])
+		r->pr_head++;
+}
+
+// Take the slot from pktring_peek and release it again at once.
+static inline void
+pktring_consume(struct Pktring *r)
+{
+	struct jif_pkt *pkt = pktring_slot(r, r->pr_next);
+
+	pktring_take(r);
+	pktring_release(r, pkt);
+}
+
+// Ask the producer for a wakeup.  Returns 1 if the ring is still empty,
+// in which case the caller may sleep; otherwise there is more to take.
+static inline bool
+pktring_arm(struct Pktring *r)
+{
+	r->pr_wait = 1;
+	__sync_synchronize();
+	return r->pr_next == r->pr_tail;
+}
+
+// poll() events
+#define POLLIN		0x001		// readable, or a connection to accept
+#define POLLOUT		0x004		// writable
+#define POLLERR		0x008
+#define POLLHUP		0x010
+#define POLLNVAL	0x020		// not a socket
+
+struct pollfd {
+	int fd;
+	short events;			// events to watch for
+	short revents;			// events that happened
+};
+
 // Definitions for requests from clients to network server
 enum {
 	// The following messages pass a page containing an Nsipc.
@@ -26,15 +147,40 @@ enum {
 	NSREQ_RECV,
 	NSREQ_SEND,
 	NSREQ_SOCKET,
+	// Stats returns a Nsret_stats on the request page.
+	NSREQ_STATS,
 
-	// The following two messages pass a page containing a struct jif_pkt
+	// The following three messages pass a page containing an Nsipc,
+	// followed by up to IPC_MAXPAGES-1 pages of the caller's buffer,
+	// which the server reads or fills in place.  Sendfile takes a
+	// struct Nsreq_sendv too, but its pages must stay unchanged (say,
+	// file server block-cache pages from mmap): the server keeps them
+	// and sends straight from them until the peer has acknowledged
+	// the data, rather than copying them into lwIP.
+	NSREQ_SENDV,
+	NSREQ_RECVV,
+	NSREQ_SENDFILE,
+	// Poll returns the number of ready sockets, and each entry's
+	// revents on the request page.
+	NSREQ_POLL,
+
+	// The following two messages pass no page.  Input tells the
+	// network server that the input ring has frames.  NSREQ_OUTPUT is
+	// no longer sent: the output helper sleeps on its ring instead.
 	NSREQ_INPUT,
-	// NSREQ_OUTPUT, unlike all other messages, is sent *from* the
-	// network server, to the output environment
 	NSREQ_OUTPUT,
 
 	// The following message passes no page
 	NSREQ_TIMER,
+
+	NSREQ_NTYPES		// number of request codes
+};
+
+// Per request type, the cycles from receiving a request to replying.
+struct Nsreqstat {
+	uint64_t rs_count;
+	uint64_t rs_cycles;
+	uint64_t rs_max;
 };
 
 union Nsipc {
@@ -90,16 +236,53 @@ union Nsipc {
 		char req_buf[0];
 	} send;
 
+	struct Nsreq_sendv {
+		int req_s;
+		int req_size;
+		unsigned int req_flags;
+		int req_off;		// offset of the data in the first data page
+	} sendv;
+
+	struct Nsreq_recvv {
+		int req_s;
+		int req_len;
+		unsigned int req_flags;
+		int req_off;		// offset of the buffer in the first data page
+	} recvv;
+
+	struct Nsreq_poll {
+		int req_nfds;
+		int req_timeout;	// msec, < 0 to wait forever
+		struct pollfd req_fds[0];	// fd is a socket id, or < 0
+	} poll;
+
 	struct Nsreq_socket {
 		int req_domain;
 		int req_type;
 		int req_protocol;
 	} socket;
 
+	// A snapshot of the server's counters.
+	struct Nsret_stats {
+		uint64_t ret_tsc;		// read_tsc() when taken
+		uint32_t ret_msec;		// sys_time_msec() when taken
+		uint32_t ret_nworkers;		// request buffers, one per worker
+		uint32_t ret_nbusy;		// ... in use, counting this request
+		uint32_t ret_inring;		// frames waiting on the input ring
+		uint32_t ret_inlent;		// input slots lent to lwIP
+		uint32_t ret_outring;		// frames waiting on the output ring
+		uint64_t ret_nrefused;		// messages refused for lack of buffers
+		struct Nsreqstat ret_req[NSREQ_NTYPES];
+		struct stats_ ret_lwip;		// lwIP's counters
+	} statsRet;
+
 	struct jif_pkt pkt;
 
 	// Ensure Nsipc is one page
 	char _pad[PGSIZE];
 };
 
+// Most sockets one NSREQ_POLL can ask about.
+#define NSPOLL_MAX	((PGSIZE - sizeof(struct Nsreq_poll)) / sizeof(struct pollfd))
+
 #endif // !JOS_INC_NS_H
@@ -22,6 +22,17 @@ enum {
 	SYS_env_mkguest,
 	SYS_env_transmit_packet,
 	SYS_env_receive_packet,
+	SYS_ide_dma_attach,
+	SYS_ide_wait_intr,
+	SYS_ipc_call,
+	SYS_ipc_send,
+	SYS_ipc_sendv,
+	SYS_ipc_recvv,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_fork_cow,
+	SYS_page_prezero,
+	SYS_ipc_alarm,
 	NSYSCALLS
 };
 
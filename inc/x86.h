@@ -19,6 +19,7 @@ static __inline void outsw(int port, const void *addr, int cnt) __attribute__((a
 static __inline void outsl(int port, const void *addr, int cnt) __attribute__((always_inline));
 static __inline void outl(int port, uint32_t data) __attribute__((always_inline));
 static __inline void invlpg(void *addr) __attribute__((always_inline));
+static __inline void invpcid(uint64_t type, uint16_t pcid, void *addr) __attribute__((always_inline));
 static __inline void lidt(void *p) __attribute__((always_inline));
 static __inline void lgdt(void *p) __attribute__((always_inline));
 static __inline void lldt(uint16_t sel) __attribute__((always_inline));
@@ -36,6 +37,7 @@ static __inline void write_eflags(uint64_t eflags) __attribute__((always_inline)
 static __inline uint64_t read_rbp(void) __attribute__((always_inline));
 static __inline uint64_t read_rsp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
+static __inline void cpuid_count(uint32_t info, uint32_t subleaf, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
 static __inline uint64_t read_msr(uint32_t ecx) __attribute__((always_inline));
 static __inline void write_msr( uint32_t ecx, uint64_t val ) __attribute__((always_inline));
@@ -152,6 +154,17 @@ invlpg(void *addr)
     __asm __volatile("invlpg (%0)" : : "r" (addr) : "memory");
 }  
 
+#ifdef __x86_64__
+// Invalidate TLB entries by PCID; type is one of the INVPCID_* in inc/mmu.h.
+// Long mode only: the boot loader includes this file in 32-bit code.
+    static __inline void
+invpcid(uint64_t type, uint16_t pcid, void *addr)
+{
+    struct { uint64_t pcid; uint64_t addr; } desc = { pcid, (uintptr_t) addr };
+    __asm __volatile("invpcid %0,%1" : : "m" (desc), "r" (type) : "memory");
+}
+#endif
+
     static __inline void
 lidt(void *p)
 {
@@ -280,6 +293,24 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
         *edxp = edx;
 }
 
+// cpuid for leaves that take a subleaf in ecx.
+    static __inline void
+cpuid_count(uint32_t info, uint32_t subleaf, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid"
+            : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+            : "a" (info), "c" (subleaf));
+    if (eaxp)
+        *eaxp = eax;
+    if (ebxp)
+        *ebxp = ebx;
+    if (ecxp)
+        *ecxp = ecx;
+    if (edxp)
+        *edxp = edx;
+}
+
 static inline uint32_t
 xchg(volatile uint32_t *addr,uint32_t newval){
     uint32_t result;
@@ -292,9 +323,9 @@ xchg(volatile uint32_t *addr,uint32_t newval){
     static __inline uint64_t
 read_tsc(void)
 {
-    uint64_t tsc;
-    __asm __volatile("rdtsc" : "=A" (tsc));
-    return tsc;
+    uint32_t lo, hi;
+    __asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
 }
 
 static __inline uint64_t
@@ -26,6 +26,8 @@ struct Cpu {
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
     bool is_vmx_root;               // Is the CPU in VMX root mode?
     uintptr_t vmxon_region;         // KVA of vmxon region.
+    uint16_t cpu_pcid_next;         // Next PCID to hand out
+    uint64_t cpu_pcid_gen;          // Bumped when PCIDs are recycled
 };
 
 // Initialized in mpconfig.c
@@ -7,6 +7,7 @@
 #include <inc/elf.h>
 
 #include <kern/env.h>
+#include <kern/syscall.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
 #include <kern/monitor.h>
@@ -15,6 +16,8 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/futex.h>
+#include <kern/ide.h>
 #include <vmm/vmx.h>
 #include <vmm/ept.h>
 
@@ -325,6 +328,11 @@ env_guest_alloc(struct Env **newenv_store, envid_t parent_id)
 
     e->env_pgfault_upcall = 0;
     e->env_ipc_recving = 0;
+    e->env_ipc_sendq = NULL;
+    e->env_ipc_send_to = 0;
+    e->env_ipc_alarm = 0;
+    e->env_futex_pa = 0;
+    e->env_pcid_gen = 0;
 
     // commit the allocation
     env_free_list = e->env_link;
@@ -421,6 +429,11 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
     // Also clear the IPC receiving flag.
     e->env_ipc_recving = 0;
+    e->env_ipc_sendq = NULL;
+    e->env_ipc_send_to = 0;
+    e->env_ipc_alarm = 0;
+    e->env_futex_pa = 0;
+    e->env_pcid_gen = 0;
 
     // commit the allocation
     env_free_list = e->env_link;
@@ -598,6 +611,11 @@ env_free(struct Env *e)
 
             if (!(env_pgdir[pdeno] & PTE_P))
                 continue;
+            if (env_pgdir[pdeno] & PTE_PS) {
+                // a superpage, no page table underneath
+                page_remove_super(e->env_pml4e, PGADDR((uint64_t)0,pdpe_index,pdeno, 0, 0));
+                continue;
+            }
             pa = PTE_ADDR(env_pgdir[pdeno]);
             pt = (pte_t*) KADDR(pa);
 
@@ -634,6 +652,10 @@ env_destroy(struct Env *e)
         return;
     }
 
+    ipc_env_free(e);
+    futex_env_free(e);
+    ide_env_free(e);
+
     if(e->env_type == ENV_TYPE_GUEST) 
         env_guest_free(e);
     else
@@ -702,7 +724,7 @@ env_run(struct Env *e)
     curenv = e;
     curenv->env_status = ENV_RUNNING;
     curenv->env_runs ++;
-    lcr3(curenv->env_cr3);
+    pcid_switch(curenv);
     env_pop_tf(&curenv->env_tf);
 }
 
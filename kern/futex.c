@@ -0,0 +1,164 @@
+// Futex-style waits on words in user memory.
+//
+// An env can sleep until a 32-bit word it shares with other envs
+// changes, instead of spinning on sys_yield.  Waiters are keyed by the
+// physical address of the word, so envs that map the shared page at
+// different addresses still find each other.  The word itself is only
+// compared, never written, by the kernel: user code changes it and
+// then calls futex_wake.
+
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/futex.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/time.h>
+
+// Envs blocked in futex_wait, most recent first.  Short in practice,
+// so wakeups just walk it.
+static struct Env *futex_waiters;
+
+// Number of waiters with a deadline, so the clock tick can skip the walk.
+static int futex_ntimed;
+
+// Physical address of the user word at uaddr in curenv, or 0 if it
+// isn't mapped with the given permissions.
+	static physaddr_t
+futex_key(uint32_t *uaddr, int perm)
+{
+	struct Page *pp;
+	pte_t *pte;
+
+	if ((uintptr_t) uaddr >= UTOP || ((uintptr_t) uaddr & 3))
+		return 0;
+	if (!(pp = page_lookup(curenv->env_pml4e, uaddr, &pte))
+	    || (*pte & (perm | PTE_P)) != (perm | PTE_P))
+		return 0;
+	return page2pa(pp) + PGOFF(uaddr);
+}
+
+// Take e off the waiter list and make it runnable, returning r from
+// its futex_wait.
+	static void
+futex_unwait(struct Env *e, int r)
+{
+	struct Env **pp;
+
+	for (pp = &futex_waiters; *pp; pp = &(*pp)->env_futex_next)
+		if (*pp == e) {
+			*pp = e->env_futex_next;
+			break;
+		}
+	if (e->env_futex_deadline)
+		futex_ntimed--;
+	e->env_futex_pa = 0;
+	e->env_futex_next = NULL;
+	e->env_tf.tf_regs.reg_rax = r;
+	e->env_status = ENV_RUNNABLE;
+}
+
+// If *uaddr still equals val, block until another env calls futex_wake
+// on the same word, the page holding it is unmapped somewhere, or
+// (if timeout is nonzero) that many milliseconds pass.  Returns 0 when
+// woken or when *uaddr had already changed, -E_IPC_TIMEOUT on timeout.
+// Callers must recheck their condition either way.
+	int
+futex_wait(uint32_t *uaddr, uint32_t val, uint32_t timeout)
+{
+	physaddr_t pa;
+
+	if (!(pa = futex_key(uaddr, PTE_U)))
+		return -E_INVAL;
+	// Nothing else runs in the kernel meanwhile, so this check and
+	// going to sleep are atomic with respect to futex_wake.
+	if (*(volatile uint32_t *) KADDR(pa) != val)
+		return 0;
+
+	curenv->env_futex_pa = pa;
+	curenv->env_futex_deadline = 0;
+	if (timeout) {
+		curenv->env_futex_deadline = MAX(time_msec() + timeout, 1);
+		futex_ntimed++;
+	}
+	curenv->env_futex_next = futex_waiters;
+	futex_waiters = curenv;
+
+	curenv->env_tf.tf_regs.reg_rax = 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Wake up to n envs waiting on the word at uaddr.  Returns the number
+// woken.
+	int
+futex_wake(uint32_t *uaddr, uint32_t n)
+{
+	struct Env *e, *next;
+	physaddr_t pa;
+	int woken = 0;
+
+	if (!(pa = futex_key(uaddr, PTE_U)))
+		return -E_INVAL;
+	for (e = futex_waiters; e && woken < n; e = next) {
+		next = e->env_futex_next;
+		if (e->env_futex_pa == pa) {
+			futex_unwait(e, 0);
+			woken++;
+		}
+	}
+	return woken;
+}
+
+// A mapping of pp is going away.  Wake everyone waiting on a word in
+// it: the unmapping env may have been the one that would have woken
+// them (a pipe end being closed, or its owner being destroyed).
+	void
+futex_page_removed(struct Page *pp)
+{
+	struct Env *e, *next;
+	physaddr_t pa;
+
+	if (!futex_waiters)
+		return;
+	pa = page2pa(pp);
+	for (e = futex_waiters; e; e = next) {
+		next = e->env_futex_next;
+		if (ROUNDDOWN(e->env_futex_pa, PGSIZE) == pa)
+			futex_unwait(e, 0);
+	}
+}
+
+// e is being destroyed: stop waiting.
+	void
+futex_env_free(struct Env *e)
+{
+	if (e->env_futex_pa)
+		futex_unwait(e, 0);
+}
+
+// Wake waiters whose deadline has passed.  Called on every clock tick.
+	void
+futex_expire(void)
+{
+	struct Env *e, *next;
+	uint32_t now;
+
+	if (!futex_ntimed)
+		return;
+	now = time_msec();
+	for (e = futex_waiters; e; e = next) {
+		next = e->env_futex_next;
+		if (e->env_futex_deadline
+		    && (int32_t) (now - e->env_futex_deadline) >= 0)
+			futex_unwait(e, -E_IPC_TIMEOUT);
+	}
+}
+
+// Whether some env is in a futex wait that will time out, for sched_yield.
+	bool
+futex_has_timed(void)
+{
+	return futex_ntimed > 0;
+}
@@ -0,0 +1,15 @@
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+#include <kern/pmap.h>
+
+int futex_wait(uint32_t *uaddr, uint32_t val, uint32_t timeout);
+int futex_wake(uint32_t *uaddr, uint32_t n);
+void futex_page_removed(struct Page *pp);
+void futex_env_free(struct Env *e);
+void futex_expire(void);
+bool futex_has_timed(void);
+
+#endif	// JOS_KERN_FUTEX_H
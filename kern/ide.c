@@ -0,0 +1,116 @@
+// Kernel half of the bus-master IDE driver.
+//
+// The disk itself is still driven from the file server (which runs with
+// IOPL 3 and talks to the controller ports directly).  The kernel only
+// finds the PIIX bus-master register block, enables bus mastering, and
+// turns IRQ 14 into a wakeup of the file server env, so that a DMA
+// transfer can be waited for without spinning on the status port.
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+#include <inc/trap.h>
+
+#include <kern/ide.h>
+#include <kern/env.h>
+#include <kern/sched.h>
+#include <kern/picirq.h>
+
+// I/O base of the bus-master register block (BAR 4), 0 if none found.
+static uint32_t ide_bmbase;
+
+// Env that owns the controller interrupt, and whether it is blocked in
+// ide_wait_intr.  An interrupt that arrives while the owner is not
+// waiting is remembered in ide_pending.
+static envid_t ide_owner;
+static bool ide_waiting;
+static bool ide_pending;
+
+int
+ide_attach_func(struct pci_func *pcif)
+{
+	// pci_func_enable also sets the bus-master enable bit.
+	pci_func_enable(pcif);
+
+	if (!pcif->reg_base[4] || pcif->reg_size[4] < 8) {
+		cprintf("ide: no bus-master registers, using PIO only\n");
+		return 0;
+	}
+	ide_bmbase = pcif->reg_base[4];
+	cprintf("ide: bus-master DMA at port 0x%x\n", ide_bmbase);
+
+	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_IDE));
+	return 1;
+}
+
+// Called from trap_dispatch on IRQ 14.
+void
+ide_intr(void)
+{
+	struct Env *e;
+
+	irq_eoi();
+
+	if (ide_waiting && envid2env(ide_owner, &e, 0) == 0
+	    && e->env_status == ENV_NOT_RUNNABLE) {
+		ide_waiting = 0;
+		e->env_status = ENV_RUNNABLE;
+		return;
+	}
+	ide_pending = 1;
+}
+
+// Register curenv as the owner of the controller interrupt and return
+// the bus-master I/O base, or -E_NO_ENT if there is no DMA controller.
+int
+ide_dma_attach(void)
+{
+	if (!ide_bmbase)
+		return -E_NO_ENT;
+	if (curenv->env_type != ENV_TYPE_FS)
+		return -E_BAD_ENV;
+
+	ide_owner = curenv->env_id;
+	ide_waiting = 0;
+	ide_pending = 0;
+	return ide_bmbase;
+}
+
+// Return at once if an interrupt arrived since the last call, otherwise
+// block the owner until ide_intr wakes it.  Callers must recheck the
+// controller status; a wakeup only means "look again".
+int
+ide_wait_intr(void)
+{
+	if (!ide_bmbase || curenv->env_id != ide_owner)
+		return -E_BAD_ENV;
+
+	if (ide_pending) {
+		ide_pending = 0;
+		return 0;
+	}
+
+	ide_waiting = 1;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	curenv->env_tf.tf_regs.reg_rax = 0;
+	sched_yield();
+}
+
+// Whether an env is blocked in ide_wait_intr, for sched_yield.
+bool
+ide_has_waiter(void)
+{
+	return ide_waiting;
+}
+
+// Called when env e is destroyed: if it owned the controller
+// interrupt, nobody does now, and nobody is waiting on it.
+void
+ide_env_free(struct Env *e)
+{
+	if (e->env_id != ide_owner)
+		return;
+	ide_owner = 0;
+	ide_waiting = 0;
+	ide_pending = 0;
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_IDE_H
+#define JOS_KERN_IDE_H
+
+#include <inc/env.h>
+#include <kern/pci.h>
+
+int ide_attach_func(struct pci_func *pcif);
+void ide_intr(void);
+int ide_dma_attach(void);
+int ide_wait_intr(void);
+bool ide_has_waiter(void);
+void ide_env_free(struct Env *e);
+
+#endif	// JOS_KERN_IDE_H
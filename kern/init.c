@@ -67,6 +67,7 @@ i386_init(void)
 
 	// Lab 2 memory management initialization functions
 	x64_vm_init();
+	pcid_init();
 
 	// Lab 3 user environment initialization functions
 	env_init();
@@ -162,6 +163,7 @@ mp_main(void)
 	// We are in high EIP now, safe to switch to kern_pgdir 
 	lcr3(boot_cr3);
 	cprintf("SMP: CPU %d starting\n", cpunum());
+	pcid_init();
 
 	lapic_init();
 	env_init_percpu();
@@ -11,6 +11,7 @@
 #include <kern/multiboot.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/futex.h>
 
 #define BOOT_PAGE_TABLE_START 0xf0008000
 #define BOOT_PAGE_TABLE_END   0xf000e000
@@ -23,7 +24,32 @@ static size_t npages_basemem; // Amount of base memory (in pages)
 pml4e_t *boot_pml4e; // Kernel's initial page directory
 physaddr_t boot_cr3; // Physical address of boot time page directory
 struct Page *pages; // Physical page state array
-static struct Page *page_free_list; // Free list of physical pages
+
+// Buddy allocator free lists.  A free block of 2^order naturally
+// aligned pages sits on free_area[order]; its first page has PP_FREE
+// set and pp_order == order, the rest of its pages are left alone.
+struct FreeArea {
+	struct Page *fa_head;	// linked through pp_link and pp_prev
+	size_t fa_nfree;	// number of blocks on the list
+};
+static struct FreeArea free_area[PAGE_NORDER];
+
+// Per-CPU caches of free single pages, so that most page_alloc and
+// page_free calls stay off the buddy lists.  Pages in a cache are
+// PP_CACHED and count as allocated as far as the buddy lists go.
+struct PageCache {
+	struct Page *pc_head;	// linked through pp_link, most recent first
+	int pc_count;
+};
+static struct PageCache page_cache[NCPU];
+#define PCACHE_BATCH	16	// pages moved to or from the buddy lists at once
+#define PCACHE_HIGH	64	// give a batch back above this many
+
+// Free pages zeroed ahead of time by page_prezero, for ALLOC_ZERO
+// requests.  Also PP_CACHED.
+static struct Page *page_zero_list;
+static size_t page_nzero;
+#define PZERO_TARGET	256	// stop zeroing at this many
 char *nextfree; // virtual address of next byte of free memory
 
 
@@ -165,7 +191,9 @@ static void check_page_alloc(void);
 static void check_boot_pml4e(pml4e_t *pml4e);
 static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
 static void page_check(void);
+static void check_superpage(void);
 static void page_initpp(struct Page *pp);
+static void buddy_free(struct Page *pp, int order);
 // This simple physical memory allocator is used only while JOS is setting
 // up its virtual memory system.  page_alloc() is the real allocator.
 //
@@ -177,7 +205,7 @@ static void page_initpp(struct Page *pp);
 //
 // If we're out of memory, boot_alloc should panic.
 // This function may ONLY be used during initialization,
-// before the page_free_list list has been set up.
+// before the page allocator has been set up.
     static void *
 boot_alloc(uint32_t n)
 {
@@ -268,6 +296,7 @@ x64_vm_init(void)
 	check_page_free_list(1);
 	check_page_alloc();
 	page_check();
+	check_superpage();
     //////////////////////////////////////////////////////////////////////
     // Now we set up virtual memory 
     //////////////////////////////////////////////////////////////////////
@@ -369,7 +398,7 @@ mem_init_mp(void)
 // Initialize page structure and memory free list.
 // After this is done, NEVER use boot_alloc again.  ONLY use the page
 // allocator functions below to allocate and deallocate physical
-// memory via the page_free_list.
+// memory via the buddy allocator.
 //
     void
 page_init(void)
@@ -394,15 +423,15 @@ page_init(void)
     // Change the code to reflect this.
     // NB: DO NOT actually touch the physical memory corresponding to
     // free pages!
-    // NB: Make sure you preserve the direction in which your page_free_list 
-    // is constructed
     // NB: Remember to mark the memory used for initial boot page table i.e (va>=BOOT_PAGE_TABLE_START && va < BOOT_PAGE_TABLE_END) as in-use (not free)
     size_t i;
-struct Page* last = NULL;
 cprintf("pages address %x\n",pages); 
 for (i = 0; i < npages; i++)
 {
 pages[i].pp_link = NULL;
+pages[i].pp_prev = NULL;
+pages[i].pp_flags = 0;
+pages[i].pp_order = 0;
 //page 0
 if (i == 0) 
 pages[i].pp_ref = 1; 
@@ -416,14 +445,157 @@ else if (i >= BOOT_PAGE_TABLE_START / PGSIZE && i <= BOOT_PAGE_TABLE_END) pages[
 
 else if(i == MPENTRY_PADDR / PGSIZE) pages[i].pp_ref = 1; 
 else 
-{ pages[i].pp_ref = 0; 
-if (last) last->pp_link = &pages[i]; 
-else page_free_list = &pages[i]; 
-last = &pages[i];
+pages[i].pp_ref = 0; 
+}
+
+// Hand the free pages to the buddy allocator, highest first, so that
+// the lowest blocks end up at the heads of the free lists and get
+// handed out first, as with the old address-ordered free list.
+for (i = npages; i-- > 0; )
+	if (pages[i].pp_ref == 0)
+		buddy_free(&pages[i], 0);
+}
+
+    static void
+buddy_push(struct Page *pp, int order)
+{
+	struct FreeArea *fa = &free_area[order];
+
+	pp->pp_flags = PP_FREE;
+	pp->pp_order = order;
+	pp->pp_prev = NULL;
+	pp->pp_link = fa->fa_head;
+	if (fa->fa_head)
+		fa->fa_head->pp_prev = pp;
+	fa->fa_head = pp;
+	fa->fa_nfree++;
+}
+
+    static void
+buddy_unlink(struct Page *pp)
+{
+	struct FreeArea *fa = &free_area[pp->pp_order];
+
+	if (pp->pp_prev)
+		pp->pp_prev->pp_link = pp->pp_link;
+	else
+		fa->fa_head = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp->pp_prev;
+	pp->pp_link = pp->pp_prev = NULL;
+	pp->pp_flags = 0;
+	pp->pp_order = 0;
+	fa->fa_nfree--;
+}
+
+// Take a free block of 2^order pages off the buddy lists, splitting
+// the smallest bigger block if there is none that size.
+    static struct Page *
+buddy_alloc(int order)
+{
+	struct Page *pp;
+	int o;
+
+	for (o = order; o < PAGE_NORDER; o++)
+		if (free_area[o].fa_head)
+			break;
+	if (o == PAGE_NORDER)
+		return NULL;
+	pp = free_area[o].fa_head;
+	buddy_unlink(pp);
+	// Put back the upper halves we don't need.
+	while (o > order) {
+		o--;
+		buddy_push(pp + (1UL << o), o);
+	}
+	return pp;
+}
+
+// Put a block of 2^order pages back on the buddy lists, merging it
+// with its buddy for as long as the buddy is free as a whole.
+    static void
+buddy_free(struct Page *pp, int order)
+{
+	size_t idx = pp - pages, bidx;
+
+	while (order < PAGE_NORDER - 1) {
+		bidx = idx ^ (1UL << order);
+		if (bidx >= npages || !(pages[bidx].pp_flags & PP_FREE)
+		    || pages[bidx].pp_order != order)
+			break;
+		buddy_unlink(&pages[bidx]);
+		idx &= ~(1UL << order);
+		order++;
+	}
+	buddy_push(&pages[idx], order);
+}
+
+// Give all but the 'keep' most recently freed pages in pc back to the
+// buddy lists.
+    static void
+page_cache_trim(struct PageCache *pc, int keep)
+{
+	struct Page **link = &pc->pc_head, *pp;
+	int i;
+
+	for (i = 0; i < keep && *link; i++)
+		link = &(*link)->pp_link;
+	while ((pp = *link)) {
+		*link = pp->pp_link;
+		pp->pp_link = NULL;
+		pp->pp_flags = 0;
+		pc->pc_count--;
+		buddy_free(pp, 0);
+	}
+}
+
+// Move up to a batch of pages from the buddy lists into pc.
+// Returns how many were moved.
+    static int
+page_cache_fill(struct PageCache *pc)
+{
+	struct Page *pp;
+	int n;
+
+	for (n = 0; n < PCACHE_BATCH && (pp = buddy_alloc(0)); n++) {
+		pp->pp_flags = PP_CACHED;
+		pp->pp_link = pc->pc_head;
+		pc->pc_head = pp;
+		pc->pc_count++;
+	}
+	return n;
 }
 
+// Give every cached page, zeroed or not, back to the buddy lists, so
+// they can merge into bigger blocks.  For when an allocation would
+// otherwise fail.
+    static void
+page_cache_drain(void)
+{
+	struct Page *pp;
+	int i;
+
+	for (i = 0; i < NCPU; i++)
+		page_cache_trim(&page_cache[i], 0);
+	while ((pp = page_zero_list)) {
+		page_zero_list = pp->pp_link;
+		page_nzero--;
+		pp->pp_link = NULL;
+		pp->pp_flags = 0;
+		buddy_free(pp, 0);
+	}
 }
 
+    static struct Page *
+page_zero_pop(void)
+{
+	struct Page *pp = page_zero_list;
+
+	if (pp) {
+		page_zero_list = pp->pp_link;
+		page_nzero--;
+	}
+	return pp;
 }
 
 //
@@ -432,6 +604,10 @@ last = &pages[i];
 // count of the page - the caller must do these if necessary (either explicitly
 // or via page_insert).
 //
+// Pages come from this CPU's page cache, which is refilled from the
+// buddy lists a batch at a time.  ALLOC_ZERO requests take a page that
+// was zeroed ahead of time if there is one.
+//
 // Be sure to set the pp_link field of the allocated page to NULL
 //
 // Returns NULL if out of free memory.
@@ -440,17 +616,89 @@ last = &pages[i];
     struct Page *
 page_alloc(int alloc_flags)
 {
+	struct PageCache *pc = &page_cache[cpunum()];
 	struct Page *pp;
-	pp = page_free_list;
-	if (pp == NULL)	return 0; // Out of memory
+
+	if ((alloc_flags & ALLOC_ZERO) && (pp = page_zero_pop()))
+		alloc_flags &= ~ALLOC_ZERO;
 	else {
-		if (alloc_flags & ALLOC_ZERO) {
-			memset(page2kva(pp), '\0', 4096);
+		if (!pc->pc_head && !page_cache_fill(pc)) {
+			// Other caches may be hoarding what's left.
+			page_cache_drain();
+			page_cache_fill(pc);
 		}
-		page_free_list = pp->pp_link;
-		pp->pp_link = NULL;
-		return pp;
+		if (!(pp = pc->pc_head))
+			return NULL; // Out of memory
+		pc->pc_head = pp->pp_link;
+		pc->pc_count--;
+	}
+
+	pp->pp_link = NULL;
+	pp->pp_flags = 0;
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(pp), '\0', PGSIZE);
+	return pp;
+}
+
+//
+// Allocates 2^order physically contiguous pages, aligned to their
+// size, for page tables or devices that need contiguous memory and
+// for superpages (order PAGE_HUGE_ORDER).  If (alloc_flags & ALLOC_ZERO),
+// zeroes all of them.  The first page is marked PP_HEAD and holds the
+// reference count for the block, the others PP_TAIL; page_free of the
+// first page frees the whole block.  Like page_alloc, doesn't touch
+// the reference count.
+//
+// Returns NULL if there is no free block that big.
+//
+    struct Page *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct Page *pp;
+	size_t i;
+
+	if (order == 0)
+		return page_alloc(alloc_flags);
+	if (order < 0 || order >= PAGE_NORDER)
+		return NULL;
+	if (!(pp = buddy_alloc(order))) {
+		page_cache_drain();
+		if (!(pp = buddy_alloc(order)))
+			return NULL;
+	}
+	for (i = 0; i < (1UL << order); i++) {
+		pp[i].pp_link = NULL;
+		pp[i].pp_flags = i ? PP_TAIL : PP_HEAD;
+		pp[i].pp_order = order;
 	}
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(pp), 0, (size_t) PGSIZE << order);
+	return pp;
+}
+
+//
+// Zero up to n free pages ahead of time for later ALLOC_ZERO requests,
+// stopping once PZERO_TARGET pages are waiting.  The idle env calls this
+// (sys_page_prezero), so the memsets happen while the CPU would
+// otherwise spin, instead of inside page faults and forks.
+// Returns the number of pages zeroed.
+//
+    int
+page_prezero(int n)
+{
+	struct Page *pp;
+	int i;
+
+	for (i = 0; i < n && page_nzero < PZERO_TARGET; i++) {
+		if (!(pp = buddy_alloc(0)))
+			break;
+		memset(page2kva(pp), 0, PGSIZE);
+		pp->pp_flags = PP_CACHED;
+		pp->pp_link = page_zero_list;
+		page_zero_list = pp;
+		page_nzero++;
+	}
+	return i;
 }
 
 //
@@ -466,23 +714,46 @@ page_initpp(struct Page *pp)
 //
 // Return a page to the free list.
 // (This function should only be called when pp->pp_ref reaches 0.)
+// A block from page_alloc_order goes straight back to the buddy lists;
+// a single page goes to this CPU's page cache.
 //
     void
 page_free(struct Page *pp)
 {
+	struct PageCache *pc;
+	size_t i;
+	int order;
+
 	assert(pp->pp_ref == 0);
-	pp->pp_link = page_free_list;
-	page_free_list = pp;
-	pp->pp_ref = 0;
+	assert(!(pp->pp_flags & (PP_FREE|PP_TAIL|PP_CACHED)));
+	if (pp->pp_flags & PP_HEAD) {
+		order = pp->pp_order;
+		for (i = 0; i < (1UL << order); i++) {
+			pp[i].pp_ref = 0;
+			pp[i].pp_flags = 0;
+			pp[i].pp_order = 0;
+		}
+		buddy_free(pp, order);
+		return;
+	}
+
+	pc = &page_cache[cpunum()];
+	pp->pp_flags = PP_CACHED;
+	pp->pp_link = pc->pc_head;
+	pc->pc_head = pp;
+	if (++pc->pc_count > PCACHE_HIGH)
+		page_cache_trim(pc, PCACHE_HIGH - PCACHE_BATCH);
 }
 
 //
 // Decrement the reference count on a page,
 // freeing it if there are no more refs.
+// For a frame of a superpage, that's the superpage's count.
 //
     void
 page_decref(struct Page* pp)
 {
+    pp = page_head(pp);
     if (--pp->pp_ref == 0)
         page_free(pp);
 }
@@ -580,7 +851,8 @@ pdpe_walk(pdpe_t *pdpt_base,const void *va,int create)
     return NULL;
 }
 // Given 'pgdir', a pointer to a page directory, pgdir_walk returns
-// a pointer to the page table entry (PTE). 
+// a pointer to the page table entry (PTE), or to the page directory
+// entry itself if 'va' lies in a superpage (PTE_PS).
 // The programming logic and the hints are the same as pml4e_walk
 // and pdpe_walk.
 
@@ -591,6 +863,10 @@ pgdir_walk(pde_t *pgdir_base, const void *va, int create)
 	pde_t *offsetd_ptr_in_pgdir = pgdir_base + index_in_pgdir;
 	pte_t *page_table_base = (pte_t*)(PTE_ADDR(*offsetd_ptr_in_pgdir));
 
+	// A superpage is mapped by the page directory entry itself.
+	if (*offsetd_ptr_in_pgdir & PTE_PS)
+		return (pte_t*) offsetd_ptr_in_pgdir;
+
 	//Check if PT exists
 	if (page_table_base == 0) {
 		if (create == 0) return NULL;
@@ -622,10 +898,59 @@ pgdir_walk(pde_t *pgdir_base, const void *va, int create)
 
 
 
+// Return a pointer to the page directory entry for 'va', allocating
+// the page directory pointer table and page directory on the way if
+// 'create'.  Returns NULL if they don't exist and can't be made.
+    static pde_t *
+pde_walk(pml4e_t *pml4, const void *va, int create)
+{
+	pml4e_t *pml4e = &pml4[PML4(va)];
+	pdpe_t *pdpe;
+	struct Page *pp;
+
+	if (!(*pml4e & PTE_P)) {
+		if (!create || !(pp = page_alloc(ALLOC_ZERO)))
+			return NULL;
+		pp->pp_ref++;
+		*pml4e = page2pa(pp) | PTE_P | PTE_U | PTE_W;
+	}
+	pdpe = (pdpe_t*) KADDR(PTE_ADDR(*pml4e)) + PDPE(va);
+	if (!(*pdpe & PTE_P)) {
+		if (!create || !(pp = page_alloc(ALLOC_ZERO)))
+			return NULL;
+		pp->pp_ref++;
+		*pdpe = page2pa(pp) | PTE_P | PTE_U | PTE_W;
+	}
+	return (pde_t*) KADDR(PTE_ADDR(*pdpe)) + PDX(va);
+}
+
+// Replace the superpage mapping in *pde by a page table that maps the
+// same frames with the same permissions, so that part of it can be
+// remapped.  Only for the boot-time kernel mappings, which don't hold
+// page references.
+    static void
+boot_pde_split(pde_t *pde)
+{
+	struct Page *pp;
+	pte_t *pt;
+	int i;
+
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		panic("boot_pde_split: out of memory");
+	pp->pp_ref++;
+	pt = page2kva(pp);
+	for (i = 0; i < NPTENTRIES; i++)
+		pt[i] = (PTE_ADDR(*pde) + i * PGSIZE)
+			| (*pde & (PTE_P | PTE_W | PTE_U | PTE_PWT | PTE_PCD));
+	*pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
+}
+
 //
 // Map [va, va+size) of virtual address space to physical [pa, pa+size)
 // in the page table rooted at pml4e.  Size is a multiple of PGSIZE.
 // Use permission bits perm|PTE_P for the entries.
+// Stretches that are PTSIZE-aligned in both va and pa are mapped with
+// 2MB superpages, which is how the KERNBASE direct map gets built.
 //
 // This function is only intended to set up the ``static'' mappings
 // above UTOP. As such, it should *not* change the pp_ref field on the
@@ -636,13 +961,55 @@ pgdir_walk(pde_t *pgdir_base, const void *va, int create)
 boot_map_segment(pml4e_t *pml4e, uintptr_t la, size_t size, physaddr_t pa, int perm)
 {	
 	char *addr, *pa_addr;
-	for (addr = (char*)la, pa_addr = (char*)pa; (uintptr_t)addr < ROUNDUP(la+size, PGSIZE); addr+=PGSIZE, pa_addr+=PGSIZE)
+	uintptr_t end = ROUNDUP(la+size, PGSIZE);
+	pde_t *pde;
+
+	for (addr = (char*)la, pa_addr = (char*)pa; (uintptr_t)addr < end; )
 	{
+		if ((perm & PTE_P) && (uintptr_t)addr % PTSIZE == 0
+		    && (uintptr_t)pa_addr % PTSIZE == 0 && end - (uintptr_t)addr >= PTSIZE) {
+			if (!(pde = pde_walk(pml4e, addr, 1)))
+				panic("boot_map_segment: out of memory");
+			*pde = (uint64_t)pa_addr | perm | PTE_PS;
+			addr += PTSIZE;
+			pa_addr += PTSIZE;
+			continue;
+		}
+		// Remapping part of a superpage: split it first.
+		if ((pde = pde_walk(pml4e, addr, 0)) && (*pde & PTE_PS))
+			boot_pde_split(pde);
 		pte_t *pte = pml4e_walk(pml4e, (void*)addr, 1);
 		*pte = (uint64_t)pa_addr | perm;
+		addr += PGSIZE;
+		pa_addr += PGSIZE;
 	}
 }
 
+// Replace the user superpage mapping in *pde, which covers va, by a
+// page table that maps the same frames with the same permissions.
+// Each of the small mappings then holds a reference to the superpage,
+// as page_insert's are.  Returns -E_NO_MEM if there is no page for
+// the table, leaving the superpage mapped.
+    static int
+page_pde_split(pml4e_t *pml4e, pde_t *pde, void *va)
+{
+	struct Page *pp, *head = pa2page(PTE_ADDR(*pde));
+	pte_t *pt;
+	int i;
+
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	pp->pp_ref++;
+	pt = page2kva(pp);
+	for (i = 0; i < NPTENTRIES; i++)
+		pt[i] = (PTE_ADDR(*pde) + i * PGSIZE)
+			| (*pde & (PTE_SYSCALL | PTE_PWT | PTE_PCD));
+	head->pp_ref += NPTENTRIES - 1;
+	*pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
+	tlb_invalidate(pml4e, va);
+	return 0;
+}
+
 //
 // Map the physical page 'pp' at virtual address 'va'.
 // The permissions (the low 12 bits) of the page table entry
@@ -667,20 +1034,83 @@ boot_map_segment(pml4e_t *pml4e, uintptr_t la, size_t size, physaddr_t pa, int p
 //
 // Hint: The TA solution is implemented using pml4e_walk, page_remove,
 // and page2pa.
+//
+// If perm includes PTE_PS, pp must be a superpage from page_alloc_order
+// and va PTSIZE-aligned; it replaces whatever was mapped in that 2MB.
+// A small page mapped inside a superpage splits it into small pages
+// first, so only the one page is replaced.
+// A frame of a superpage may be mapped as a small page on its own; it
+// then holds a reference to the superpage.
 //
     int
 page_insert(pml4e_t *pml4e, struct Page *pp, void *va, int perm)
 {
+	struct Page *head = page_head(pp);
+	pde_t *pde;
+	pte_t *pt;
+	int i;
+
+	if (perm & PTE_PS) {
+		if (!(pp->pp_flags & PP_HEAD) || pp->pp_order != PAGE_HUGE_ORDER
+		    || (uintptr_t)va % PTSIZE)
+			return -E_INVAL;
+		if (!(pde = pde_walk(pml4e, va, 1)))
+			return -E_NO_MEM;
+		pp->pp_ref++;
+		if (*pde & PTE_PS)
+			page_remove_super(pml4e, va);
+		else if (*pde & PTE_P) {
+			// Drop the small pages and the page table underneath.
+			pt = KADDR(PTE_ADDR(*pde));
+			for (i = 0; i < NPTENTRIES; i++)
+				if (pt[i] & PTE_P)
+					page_remove(pml4e, (char*)va + i * PGSIZE);
+			page_decref(pa2page(PTE_ADDR(*pde)));
+		}
+		*pde = ((uint64_t)page2pa(pp)) | perm | PTE_P;
+		tlb_invalidate(pml4e, va);
+		return 0;
+	}
+
+	if ((pde = pde_walk(pml4e, va, 0)) && (*pde & PTE_PS)
+	    && page_pde_split(pml4e, pde, va) < 0)
+		return -E_NO_MEM;
+
+	// Take the reference first, in case pp is the page being replaced.
+	head->pp_ref++;
+
 	pte_t * pte = pml4e_walk(pml4e, (void*)va, 1);
-	if (pte == NULL) return -E_NO_MEM;
+	if (pte == NULL) {
+		head->pp_ref--;
+		return -E_NO_MEM;
+	}
 
-	pp->pp_ref++;
 	if(*pte & PTE_P)
 		page_remove(pml4e, va);
 	*pte = ((uint64_t)page2pa(pp)) | perm | PTE_P;
     return 0;
 }
 
+//
+// Make sure page_insert of a small page at va can't fail for lack of
+// memory: allocate the page tables that lead to va's entry, splitting
+// a superpage that covers va.  What is mapped stays mapped.
+// Returns -E_NO_MEM if a page table couldn't be allocated.
+//
+    int
+page_reserve(pml4e_t *pml4e, void *va)
+{
+	pde_t *pde;
+
+	if (!(pde = pde_walk(pml4e, va, 1)))
+		return -E_NO_MEM;
+	if (*pde & PTE_PS)
+		return page_pde_split(pml4e, pde, va);
+	if (!pml4e_walk(pml4e, va, 1))
+		return -E_NO_MEM;
+	return 0;
+}
+
 //
 // Return the page mapped at virtual address 'va'.
 // If pte_store is not zero, then we store in it the address
@@ -690,6 +1120,9 @@ page_insert(pml4e_t *pml4e, struct Page *pp, void *va, int perm)
 //
 // Return NULL if there is no page mapped at va.
 //
+// Inside a superpage, the result is the frame backing va, and the
+// "pte" is the page directory entry, with PTE_PS set.
+//
 // Hint: the TA solution uses pml4e_walk and pa2page.
 //
     struct Page *
@@ -697,12 +1130,15 @@ page_lookup(pml4e_t *pml4e, void *va, pte_t **pte_store)
 {    
 	pte_t * pte = pml4e_walk(pml4e, (void*)va, 0);
 	if (pte == NULL) {
-		*pte_store = NULL;
+		if (pte_store != NULL)
+			*pte_store = NULL;
 		return NULL;
 	}
 	if (*pte != 0) {
 		if (pte_store != NULL)
 			*pte_store = pte;
+		if (*pte & PTE_PS)
+			return pa2page((physaddr_t)(PTE_ADDR(*pte))) + PTX(va);
 		return pa2page((physaddr_t)(PTE_ADDR(*pte)));
 	}
     return NULL;
@@ -723,32 +1159,184 @@ page_lookup(pml4e_t *pml4e, void *va, pte_t **pte_store)
 // Hint: The TA solution is implemented using page_lookup,
 // 	tlb_invalidate, and page_decref.
 //
-    void
+// If va is in a superpage, the superpage is split into small pages
+// first, so only the one page is unmapped.  Returns -E_NO_MEM if there
+// is no page for the page table, leaving everything mapped; 0 otherwise.
+// page_remove_super unmaps a whole superpage.
+//
+    int
 page_remove(pml4e_t *pml4e, void *va)
 {
 	pte_t *pte;
 	struct Page *pp = page_lookup(pml4e, va, &pte);
 	if (pp) {
+		if (*pte & PTE_PS) {
+			if (page_pde_split(pml4e, pte, va) < 0)
+				return -E_NO_MEM;
+			pte = pml4e_walk(pml4e, va, 0);
+		}
 		if (pte) {
 			*pte = 0;
 			tlb_invalidate(pml4e, va);
 		}
+		futex_page_removed(pp);
 		page_decref(pp);
 	}
+	return 0;
+}
+
+//
+// Unmap the whole superpage mapped at va, which must be PTSIZE-aligned.
+// Does nothing if there is no superpage there.
+//
+    void
+page_remove_super(pml4e_t *pml4e, void *va)
+{
+	pde_t *pde = pde_walk(pml4e, va, 0);
+	struct Page *pp;
+	int i;
+
+	if (!pde || !(*pde & PTE_PS))
+		return;
+	pp = pa2page(PTE_ADDR(*pde));
+	*pde = 0;
+	tlb_invalidate(pml4e, va);
+	for (i = 0; i < NPTENTRIES; i++)
+		futex_page_removed(pp + i);
+	page_decref(pp);
+}
+
+// --------------------------------------------------------------
+// TLB tagging with PCIDs.
+//
+// With CR4_PCIDE on, TLB entries are tagged with the PCID in CR3, so
+// env_run can switch address spaces without flushing the TLB and an
+// env finds its entries still there when it runs again.  Each CPU
+// hands out PCIDs 1..PCID_MAX-1 to envs as they run on it; when they
+// run out, it starts a new generation, flushes everything, and envs
+// from older generations get new PCIDs as they next run.  PCID 0 is
+// for boot_cr3 and for the kernel's own lcr3() calls, which always
+// flush.
+//
+// Changing the page tables of an address space that isn't loaded can
+// leave stale entries under its PCID.  tlb_invalidate marks the
+// address space's pml4 page PP_TLB_STALE instead, and the env owning
+// it gets its PCID flushed when it next runs.  Other envs keep theirs.
+// --------------------------------------------------------------
+
+#define PCID_MAX	4096
+
+static bool pcid_enabled;	// CR4_PCIDE is on
+static bool invpcid_ok;		// and the invpcid instruction works
+
+// Turn on PCIDs on this CPU, if it has them.  Called with boot_cr3
+// loaded.
+    void
+pcid_init(void)
+{
+#ifndef NO_PCID
+	uint32_t ecx, ebx;
+
+	cpuid(1, NULL, NULL, &ecx, NULL);
+	if (!(ecx & CPUID_1_ECX_PCID))
+		return;
+	cpuid_count(7, 0, NULL, &ebx, NULL, NULL);
+	invpcid_ok = (ebx & CPUID_7_EBX_INVPCID) != 0;
+
+	thiscpu->cpu_pcid_gen = 1;
+	thiscpu->cpu_pcid_next = 1;
+	// PCIDE can only be turned on while CR3 holds PCID 0.
+	lcr3(boot_cr3);
+	lcr4(rcr4() | CR4_PCIDE);
+	pcid_enabled = 1;
+	cprintf("PCID enabled%s\n", invpcid_ok ? ", with invpcid" : "");
+#endif
+}
+
+// Drop every TLB entry under every PCID.
+    static void
+tlb_flush_all(void)
+{
+	uint64_t cr4;
+
+	if (invpcid_ok) {
+		invpcid(INVPCID_ALL, 0, 0);
+		return;
+	}
+	// Turning PCIDE off flushes everything; turning it back on needs
+	// PCID 0 in CR3.
+	cr4 = rcr4();
+	lcr4(cr4 & ~CR4_PCIDE);
+	lcr3(rcr3() & ~CR3_PCID_MASK);
+	lcr4(cr4);
+}
+
+// Drop the TLB entries of the address space currently loaded, for
+// when its page tables have changed wholesale.
+    void
+tlb_flush_current(void)
+{
+	// Without CR3_NOFLUSH, reloading CR3 flushes its PCID.
+	lcr3(rcr3());
+}
+
+// Load e's address space.  With PCIDs, its TLB entries from last time
+// it ran on this CPU are kept unless they may be stale.
+    void
+pcid_switch(struct Env *e)
+{
+	struct Cpu *c = thiscpu;
+	struct Page *pml4 = pa2page(e->env_cr3);
+	uint64_t cr3;
+
+	if (!pcid_enabled) {
+		lcr3(e->env_cr3);
+		return;
+	}
+
+	if (e->env_pcid_gen != c->cpu_pcid_gen || e->env_pcid_cpu != cpunum()) {
+		if (c->cpu_pcid_next >= PCID_MAX) {
+			c->cpu_pcid_gen++;
+			c->cpu_pcid_next = 1;
+			tlb_flush_all();
+		}
+		// A PCID not yet used in this generation has no entries.
+		e->env_pcid = c->cpu_pcid_next++;
+		e->env_pcid_cpu = cpunum();
+		e->env_pcid_gen = c->cpu_pcid_gen;
+		pml4->pp_flags &= ~PP_TLB_STALE;
+		lcr3(e->env_cr3 | e->env_pcid | CR3_NOFLUSH);
+		return;
+	}
+
+	cr3 = e->env_cr3 | e->env_pcid;
+	if (pml4->pp_flags & PP_TLB_STALE) {
+		pml4->pp_flags &= ~PP_TLB_STALE;
+		lcr3(cr3);
+	} else if (rcr3() != cr3)
+		lcr3(cr3 | CR3_NOFLUSH);
 }
 
 //
 // Invalidate a TLB entry, but only if the page tables being
 // edited are the ones currently in use by the processor.
+// With PCIDs, other address spaces may have the entry cached too;
+// see above.
 //
     void
 tlb_invalidate(pml4e_t *pml4e, void *va)
 {
 	assert(pml4e != NULL);
+	if ((uintptr_t) va >= UTOP && pcid_enabled) {
+		// Kernel mappings are shared by every address space.
+		tlb_flush_all();
+		return;
+	}
     // Flush the entry only if we're modifying the current address space.
-    assert(pml4e!=NULL);
     if (!curenv || curenv->env_pml4e == pml4e)
         invlpg(va);
+    if (pcid_enabled && (!curenv || curenv->env_pml4e != pml4e))
+        pa2page(PADDR(pml4e))->pp_flags |= PP_TLB_STALE;
 }
 
 //
@@ -853,44 +1441,58 @@ user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
 // --------------------------------------------------------------
 
 //
-// Check that the pages on the page_free_list are reasonable.
+// The checks below look at every free page, and simulate running out
+// of memory, by allocating all the free pages and later freeing them
+// again.  check_take_free returns them linked through pp_link.
 //
+    static struct Page *
+check_take_free(void)
+{
+    struct Page *fl = NULL, *pp;
+
+    while ((pp = page_alloc(0))) {
+        pp->pp_link = fl;
+        fl = pp;
+    }
+    return fl;
+}
 
     static void
-check_page_free_list(bool only_low_memory)
+check_give_free(struct Page *fl)
 {
     struct Page *pp;
+
+    while ((pp = fl)) {
+        fl = pp->pp_link;
+        pp->pp_link = NULL;
+        page_free(pp);
+    }
+}
+
+//
+// Check that the free pages are reasonable.
+//
+
+    static void
+check_page_free_list(bool only_low_memory)
+{
+    struct Page *pp, *fl;
     unsigned pdx_limit = only_low_memory ? 1 : NPDENTRIES;
     uint64_t nfree_basemem = 0, nfree_extmem = 0;
     char *first_free_page;
 
-    if (!page_free_list)
-        panic("'page_free_list' is a null pointer!");
-
-    if (only_low_memory) {
-        // Move pages with lower addresses first in the free
-        // list, since entry_pgdir does not map all pages.
-        struct Page *pp1, *pp2;
-        struct Page **tp[2] = { &pp1, &pp2 };
-        for (pp = page_free_list; pp; pp = pp->pp_link) {
-            int pagetype = PDX(page2pa(pp)) >= pdx_limit;
-            *tp[pagetype] = pp;
-            tp[pagetype] = &pp->pp_link;
-        }
-        *tp[1] = 0;
-        *tp[0] = pp2;
-        page_free_list = pp1;
-    }
+    if (!(fl = check_take_free()))
+        panic("no free pages!");
 
     // if there's a page that shouldn't be on the free list,
     // try to make sure it eventually causes trouble.
-    for (pp = page_free_list; pp; pp = pp->pp_link)
+    for (pp = fl; pp; pp = pp->pp_link)
         if (PDX(page2pa(pp)) < pdx_limit)
             memset(page2kva(pp), 0x97, 128);
     int count=0;
     cprintf("count: %d",count);
     first_free_page = (char *) boot_alloc(0);
-    for (pp = page_free_list; pp; pp = pp->pp_link) {
+    for (pp = fl; pp; pp = pp->pp_link) {
         // check that we didn't corrupt the free list itself
         assert(pp >= pages);
         assert(pp < pages + npages);
@@ -917,6 +1519,7 @@ check_page_free_list(bool only_low_memory)
 
 	assert(nfree_basemem > 0);
     assert(nfree_extmem > 0);
+    check_give_free(fl);
 }
 
 //
@@ -935,11 +1538,12 @@ check_page_alloc(void)
     // if there's a page that shouldn't be on
     // the free list, try to make sure it
     // eventually causes trouble.
-    for (pp0 = page_free_list, nfree = 0; pp0; pp0 = pp0->pp_link) {
+    fl = check_take_free();
+    for (pp0 = fl, nfree = 0; pp0; pp0 = pp0->pp_link) {
         memset(page2kva(pp0), 0x97, PGSIZE);
     }
 
-    for (pp0 = page_free_list, nfree = 0; pp0; pp0 = pp0->pp_link) {
+    for (pp0 = fl, nfree = 0; pp0; pp0 = pp0->pp_link) {
         // check that we didn't corrupt the free list itself
         assert(pp0 >= pages);
         assert(pp0 < pages + npages);
@@ -950,6 +1554,8 @@ check_page_alloc(void)
         assert(page2pa(pp0) != EXTPHYSMEM - PGSIZE);
         assert(page2pa(pp0) != EXTPHYSMEM);
     }
+    check_give_free(fl);
+
     // should be able to allocate three pages
     pp0 = pp1 = pp2 = 0;
     assert((pp0 = page_alloc(0)));
@@ -963,8 +1569,7 @@ check_page_alloc(void)
     assert(page2pa(pp2) < npages*PGSIZE);
 
     // temporarily steal the rest of the free pages
-    fl = page_free_list;
-    page_free_list = 0;
+    fl = check_take_free();
 
     // should be no free memory
     assert(!page_alloc(0));
@@ -992,7 +1597,7 @@ check_page_alloc(void)
         assert(c[i] == 0);
 
     // give free list back
-    page_free_list = fl;
+    check_give_free(fl);
 
     // free the pages we took
     page_free(pp0);
@@ -1092,6 +1697,8 @@ check_va2pa(pml4e_t *pml4e, uintptr_t va)
     pde = &pde[PDX(va)];
     if (!(*pde & PTE_P))
         return ~0;
+    if (*pde & PTE_PS)
+        return PTE_ADDR(*pde) + PTX(va) * PGSIZE;
     pte = (pte_t*) KADDR(PTE_ADDR(*pde));
     // cprintf(" %x %x " , pte, *pte);
     if (!(pte[PTX(va)] & PTE_P))
@@ -1128,8 +1735,7 @@ page_check(void)
     assert(pp5 && pp5 != pp4 && pp5 != pp3 && pp5 != pp2 && pp5 != pp1 && pp5 != pp0);
 
     // temporarily steal the rest of the free pages
-    fl = page_free_list;
-    page_free_list = NULL;
+    fl = check_take_free();
 
     // should be no free memory
     assert(!page_alloc(0));
@@ -1263,7 +1869,7 @@ page_check(void)
     boot_pml4e[0] = 0;
 
     // give free list back
-    page_free_list = fl;
+    check_give_free(fl);
 
     // free the pages we took
     page_decref(pp0);
@@ -1298,3 +1904,53 @@ page_check(void)
     cprintf("check_page() succeeded!\n");
 }
 
+// check that removing small pages inside a superpage keeps the rest
+    static void
+check_superpage(void)
+{
+    struct Page *pp, *pt;
+    pdpe_t *pdpe;
+    pde_t *pde;
+    int i, hole;
+
+    assert(!boot_pml4e[0]);
+    assert((pp = page_alloc_order(PAGE_HUGE_ORDER, ALLOC_ZERO)));
+    assert(page_insert(boot_pml4e, pp, 0x0, PTE_W | PTE_PS) == 0);
+    pdpe = KADDR(PTE_ADDR(boot_pml4e[0]));
+    pde = KADDR(PTE_ADDR(pdpe[0]));
+    assert(pde[0] & PTE_PS);
+    assert(pp->pp_ref == 1);
+
+    // Unmap a page in the middle, then remap the superpage and unmap
+    // the page at its start; either way the other 511 stay mapped.
+    for (hole = 5; hole >= 0; hole -= 5) {
+        assert(page_remove(boot_pml4e, (void *) (uintptr_t) (hole * PGSIZE)) == 0);
+        assert(!(pde[0] & PTE_PS));
+        assert(check_va2pa(boot_pml4e, hole * PGSIZE) == ~0);
+        for (i = 0; i < NPTENTRIES; i++)
+            if (i != hole)
+                assert(check_va2pa(boot_pml4e, i * PGSIZE)
+                       == page2pa(pp) + i * PGSIZE);
+        assert(pp->pp_ref == NPTENTRIES - 1);
+        if (hole) {
+            assert(page_insert(boot_pml4e, pp, 0x0, PTE_W | PTE_PS) == 0);
+            assert(pde[0] & PTE_PS);
+            assert(pp->pp_ref == 1);
+        }
+    }
+
+    // Unmapping the rest frees the superpage.
+    for (i = 1; i < NPTENTRIES; i++)
+        assert(page_remove(boot_pml4e, (void *) (uintptr_t) (i * PGSIZE)) == 0);
+    assert(pp->pp_ref == 0);
+
+    pt = pa2page(PTE_ADDR(pde[0]));
+    pde[0] = 0;
+    page_decref(pt);
+    page_decref(pa2page(PTE_ADDR(pdpe[0])));
+    page_decref(pa2page(PTE_ADDR(boot_pml4e[0])));
+    boot_pml4e[0] = 0;
+
+    cprintf("check_superpage() succeeded!\n");
+}
+
@@ -55,17 +55,37 @@ enum {
 	ALLOC_ZERO = 1<<0,
 };
 
+// struct Page pp_flags.  A block from page_alloc_order is 2^pp_order
+// physically contiguous, naturally aligned frames; the first is marked
+// PP_HEAD and holds the reference count for all of them, the rest are
+// PP_TAIL.  A superpage is such a block of order PAGE_HUGE_ORDER.
+#define PP_FREE		0x1	// first page of a block on a buddy free list
+#define PP_HEAD		0x2	// first frame of a block from page_alloc_order
+#define PP_TAIL		0x4	// other frame of such a block
+#define PP_CACHED	0x8	// free, in a per-CPU page cache or the zeroed pool
+#define PP_TLB_STALE	0x10	// pml4 page whose PCID may hold stale entries
+
+#define PAGE_NORDER	11	// buddy blocks of up to 2^10 pages (4MB)
+#define PAGE_HUGE_ORDER	(PTSHIFT - PGSHIFT)	// a 2MB superpage
+
 void    x64_vm_init();
 
 void	page_init(void);
 struct Page * page_alloc(int alloc_flags);
+struct Page * page_alloc_order(int order, int alloc_flags);
+int	page_prezero(int n);
 void	page_free(struct Page *pp);
 int	page_insert(pml4e_t *pml4e, struct Page *pp, void *va, int perm);
-void	page_remove(pml4e_t *pml4e, void *va);
+int	page_reserve(pml4e_t *pml4e, void *va);
+int	page_remove(pml4e_t *pml4e, void *va);
+void	page_remove_super(pml4e_t *pml4e, void *va);
 struct Page *page_lookup(pml4e_t *pml4e, void *va, pte_t **pte_store);
 void	page_decref(struct Page *pp);
 
 void	tlb_invalidate(pml4e_t *pml4e, void *va);
+void	tlb_flush_current(void);
+void	pcid_init(void);
+void	pcid_switch(struct Env *e);
 
 void *	mmio_map_region(physaddr_t pa, size_t size);
 
@@ -98,6 +118,16 @@ page2kva(struct Page *pp)
 	return KADDR(page2pa(pp));
 }
 
+// The page holding pp's reference count: the first frame of its
+// block, if it's part of one from page_alloc_order.
+static inline struct Page*
+page_head(struct Page *pp)
+{
+	if (pp->pp_flags & PP_TAIL)
+		return pa2page(ROUNDDOWN(page2pa(pp), (uint64_t) PGSIZE << pp->pp_order));
+	return pp;
+}
+
 pte_t *pgdir_walk(pde_t *pgdir, const void *va, int create);
 
 pte_t *pml4e_walk(pml4e_t *pml4e, const void *va, int create);
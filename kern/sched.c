@@ -3,6 +3,9 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/ide.h>
+#include <kern/futex.h>
+#include <kern/syscall.h>
 
 #include <vmm/vmx.h>
 
@@ -101,6 +104,13 @@ sched_yield(void)
         }
     }
 
+    // An env blocked on a device interrupt, on a send or futex wait
+    // that can time out, or on an alarm, will be woken, so idle rather
+    // than give up.
+    if (i == NENV && (ide_has_waiter() || ipc_send_has_timed()
+                      || ipc_alarm_has_armed() || futex_has_timed()))
+        i = 0;
+
     if (i == NENV) {
 	#ifdef POST_PROCESS_DEDUP
         // Run post processing env of dedup module
@@ -14,6 +14,8 @@
 #include <kern/time.h>
 #include <vmm/ept.h>
 #include <kern/e1000.h>
+#include <kern/ide.h>
+#include <kern/futex.h>
 #define debug 0
 
 // Print a string to the system console.
@@ -107,6 +109,93 @@ sys_exofork(void)
     panic("sys_exofork not implemented");
 }
 
+// Create a child env that shares curenv's address space copy-on-write,
+// in one pass over curenv's page tables instead of lib/fork.c's two
+// sys_page_map calls per page.  PTE_SHARE pages are shared as they
+// are, writable and copy-on-write pages become read-only PTE_COW in
+// both envs, and other pages are shared read-only.  The child gets a
+// fresh exception stack and curenv's page fault upcall, which breaks
+// copy-on-write as before, and is made runnable.  Superpages are
+// shared the same way as a whole; the kernel breaks those itself.
+//
+// Returns the child's envid (0 in the child), or < 0 on error.
+	static envid_t
+sys_fork_cow(void)
+{
+	struct Env *child;
+	struct Page *pp;
+	pdpe_t *pdpe;
+	pde_t *pgdir;
+	pte_t *pt;
+	uint64_t pdpeno, pdeno, pteno;
+	uintptr_t va;
+	int perm, r;
+
+	if ((r = env_alloc(&child, curenv->env_id)) < 0)
+		return r;
+	child->env_tf = curenv->env_tf;
+	child->env_tf.tf_regs.reg_rax = 0;
+
+	pdpe = KADDR(PTE_ADDR(curenv->env_pml4e[0]));
+	for (pdpeno = 0; pdpeno <= PDPE(UXSTACKTOP - 1); pdpeno++) {
+		if (!(pdpe[pdpeno] & PTE_P))
+			continue;
+		pgdir = KADDR(PTE_ADDR(pdpe[pdpeno]));
+		for (pdeno = 0; pdeno < NPDENTRIES; pdeno++) {
+			if (!(pgdir[pdeno] & PTE_P))
+				continue;
+			if (pgdir[pdeno] & PTE_PS) {
+				// A superpage: handle it as one big page.
+				va = (uintptr_t) PGADDR(0ULL, pdpeno, pdeno, 0, 0);
+				if (!(pgdir[pdeno] & PTE_U) || va + PTSIZE > UXSTACKTOP - PGSIZE)
+					continue;
+				if (!(pgdir[pdeno] & PTE_SHARE) && (pgdir[pdeno] & (PTE_W|PTE_COW)))
+					pgdir[pdeno] = (pgdir[pdeno] & ~PTE_W) | PTE_COW;
+				perm = (pgdir[pdeno] & PTE_SYSCALL) | PTE_PS;
+				pp = pa2page(PTE_ADDR(pgdir[pdeno]));
+				if ((r = page_insert(child->env_pml4e, pp, (void *) va, perm)) < 0)
+					goto fail;
+				continue;
+			}
+			pt = KADDR(PTE_ADDR(pgdir[pdeno]));
+			for (pteno = 0; pteno < NPTENTRIES; pteno++) {
+				va = (uintptr_t) PGADDR(0ULL, pdpeno, pdeno, pteno, 0);
+				if (!(pt[pteno] & PTE_P) || !(pt[pteno] & PTE_U)
+				    || va >= UXSTACKTOP - PGSIZE)
+					continue;
+				if (!(pt[pteno] & PTE_SHARE) && (pt[pteno] & (PTE_W|PTE_COW)))
+					pt[pteno] = (pt[pteno] & ~PTE_W) | PTE_COW;
+				perm = pt[pteno] & PTE_SYSCALL;
+				pp = pa2page(PTE_ADDR(pt[pteno]));
+				if ((r = page_insert(child->env_pml4e, pp, (void *) va, perm)) < 0)
+					goto fail;
+			}
+		}
+	}
+	// Our own writable mappings just became read-only.
+	tlb_flush_current();
+
+	if (curenv->env_pgfault_upcall) {
+		r = -E_NO_MEM;
+		if (!(pp = page_alloc(ALLOC_ZERO)))
+			goto fail;
+		if (page_insert(child->env_pml4e, pp, (void *) (UXSTACKTOP - PGSIZE),
+				PTE_P|PTE_U|PTE_W) < 0) {
+			page_free(pp);
+			goto fail;
+		}
+		child->env_pgfault_upcall = curenv->env_pgfault_upcall;
+	}
+
+	child->env_status = ENV_RUNNABLE;
+	return child->env_id;
+
+fail:
+	tlb_flush_current();
+	env_destroy(child);
+	return r;
+}
+
 // Set envid's env_status to status, which must be ENV_RUNNABLE
 // or ENV_NOT_RUNNABLE.
 //
@@ -190,6 +279,21 @@ sys_env_receive_packet(envid_t envid, char *data, size_t *len)
 	panic("sys_env_set_trapframe not implemented");
 }
 
+// Claim the bus-master IDE controller for the file server.
+// Returns the bus-master I/O base, or -E_NO_ENT if there is none.
+	static int
+sys_ide_dma_attach(void)
+{
+	return ide_dma_attach();
+}
+
+// Block until the IDE controller raises an interrupt.
+	static int
+sys_ide_wait_intr(void)
+{
+	return ide_wait_intr();
+}
+
 // Set the page fault upcall for 'envid' by modifying the corresponding struct
 // Env's 'env_pgfault_upcall' field.  When 'envid' causes a page fault, the
 // kernel will push a fault record onto the exception stack, then branch to
@@ -221,6 +325,9 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 //
 // perm -- PTE_U | PTE_P must be set, PTE_AVAIL | PTE_W may or may not be set,
 //         but no other bits may be set.  See PTE_SYSCALL in inc/mmu.h.
+//         PTE_PS may also be set to ask for a 2MB superpage of contiguous
+//         frames; va must then be PTSIZE-aligned, and whatever was
+//         mapped in [va, va+PTSIZE) is unmapped.
 //
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -243,15 +350,22 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 		return -E_INVAL;
 	if (!(perm & PTE_U) || !(perm & PTE_P))
 		return -E_INVAL;
+	if ((perm & PTE_PS) && (uint64_t)va % PTSIZE)
+		return -E_INVAL;
 	struct Page *p = NULL;
-        if (!(p = page_alloc(ALLOC_ZERO)))
+	if (perm & PTE_PS)
+		p = page_alloc_order(PAGE_HUGE_ORDER, ALLOC_ZERO);
+	else
+		p = page_alloc(ALLOC_ZERO);
+        if (!p)
                 return -E_NO_MEM;
      	struct Env *env;
         int err = envid2env(envid, &env, 1);
-        if (err < 0)
+        if (err < 0) {
+		page_free(p);
                 return err;
-        else if (err == 0) {
-		page_remove(env->env_pml4e, va);		
+	} else if (err == 0) {
+		// page_insert replaces whatever is mapped at va.
 		if (page_insert(env->env_pml4e, p, va, perm) < 0) {
 			page_free(p);
 			return -E_NO_MEM;
@@ -276,6 +390,8 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 //	-E_INVAL if perm is inappropriate (see sys_page_alloc).
 //	-E_INVAL if (perm & PTE_W), but srcva is read-only in srcenvid's
 //		address space.
+//	-E_INVAL if (perm & PTE_PS), but srcva is not the start of a
+//		superpage or dstva is not PTSIZE-aligned.
 //	-E_NO_MEM if there's no memory to allocate any necessary page tables.
     static int
 sys_page_map(envid_t srcenvid, void *srcva,
@@ -294,6 +410,9 @@ sys_page_map(envid_t srcenvid, void *srcva,
 
 	if (!(perm & PTE_U) || !(perm & PTE_P))
                 return -E_INVAL;
+	if ((perm & PTE_PS)
+	    && ((uint64_t)srcva % PTSIZE || (uint64_t)dstva % PTSIZE))
+		return -E_INVAL;
 
         struct Env *srcenv, *dstenv;
         int srcerr = envid2env(srcenvid, &srcenv, 1);
@@ -311,11 +430,10 @@ sys_page_map(envid_t srcenvid, void *srcva,
                 	return -E_INVAL;
 	        if (!(*pte & PTE_U))
                 	return -E_INVAL;
+		if ((perm & PTE_PS) && !(*pte & PTE_PS))
+			return -E_INVAL;
 
-                if (page_insert(dstenv->env_pml4e, pp, dstva, perm) < 0)
-                        return -E_NO_MEM;
-		else
-			return 0;
+		return page_insert(dstenv->env_pml4e, pp, dstva, perm);
 	}
     panic("sys_page_map not implemented");
 }
@@ -327,6 +445,8 @@ sys_page_map(envid_t srcenvid, void *srcva,
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
 //	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_NO_MEM if va is inside a superpage and there's no memory
+//		to split it into small pages.
     static int
 sys_page_unmap(envid_t envid, void *va)
 {
@@ -339,10 +459,8 @@ sys_page_unmap(envid_t envid, void *va)
         int err = envid2env(envid, &env, 1);
         if (err < 0)
                 return err;
-        else if (err == 0) {
-		page_remove(env->env_pml4e, va);
-		return 0;
-	}
+        else if (err == 0)
+		return page_remove(env->env_pml4e, va);
     panic("sys_page_unmap not implemented");
 }
 
@@ -384,8 +502,8 @@ sys_page_unmap(envid_t envid, void *va)
 //		current environment's address space.
 //	-E_NO_MEM if there's not enough memory to map srcva in envid's
 //		address space.
-	int
-sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+	static int
+ipc_try_send_from(struct Env *src, envid_t envid, uint32_t value, void *srcva, unsigned perm)
 {
 	struct Env *env;
 	pte_t *pte;
@@ -406,8 +524,8 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 		}
 
 		//Check if srcva is mapped to in caller's address space.
-		if(curenv->env_type == ENV_TYPE_GUEST){
-			int output=	ept_lookup_gpa(curenv->env_pml4e, srcva,0 ,&pte);
+		if(src->env_type == ENV_TYPE_GUEST){
+			int output=	ept_lookup_gpa(src->env_pml4e, srcva,0 ,&pte);
 		//	cprintf("sys_ipc_try_send :: ept_lookup_gpa=[%d] :: -E_INVAL[%d] ::-E_NO_ENT[%d],-E_NO_MEM=[%d] *pte=[%x]",output,-E_INVAL,-E_NO_ENT,-E_NO_MEM,*pte);
 			if(output < 0 || pte==NULL){
 				cprintf("\n sys_ipc_try_send :: ept_lookup_gpa :: Failed :: output=[%d]\n",output);
@@ -415,7 +533,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 			}
 		}
 		else{
-			pte = pml4e_walk(curenv->env_pml4e, srcva, 0);
+			pte = pml4e_walk(src->env_pml4e, srcva, 0);
 		}
 		if (!pte || !((*pte) & PTE_P)) {
 			cprintf("\nsys_ipc_try_send failed: Page is not mapped to srcva\n");
@@ -440,15 +558,17 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 
 	env->env_ipc_recving = 0;
 	env->env_ipc_value = value;
-	env->env_ipc_from = curenv->env_id;
+	env->env_ipc_from = src->env_id;
 	env->env_ipc_perm = 0;
+	env->env_ipc_npages = 0;
+	env->env_ipc_len = 0;
 
 	if ((uint64_t)srcva < UTOP) {
 		pte_t *pite;
 		struct Page *pp;
-		if(curenv->env_type == ENV_TYPE_GUEST){
+		if(src->env_type == ENV_TYPE_GUEST){
 			uint64_t *phy_page_gpa;
-			int output = ept_lookup_gpa(curenv->env_pml4e, srcva, 1,&pte);
+			int output = ept_lookup_gpa(src->env_pml4e, srcva, 1,&pte);
 		//	cprintf("sys_ipc_try_send :: ept_lookup_gpa=[%d] :: -E_INVAL[%d] ::-E_NO_ENT[%d],-E_NO_MEM=[%d],*pte=[%x]",output,-E_INVAL,-E_NO_ENT,-E_NO_MEM,*pte);
 			if(!epte_present(*pte)) {
 				cprintf("\nsys_try_ipc_send: Page not found in VMGUEST\n");
@@ -461,7 +581,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 				return val;
 		}
 		else	{   
-			pp = page_lookup(curenv->env_pml4e, srcva, &pte);
+			pp = page_lookup(src->env_pml4e, srcva, &pte);
 			if (!pp) {
 				cprintf("\nsys_try_ipc_send: Page not found\n");
 				return -1;
@@ -471,11 +591,352 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 				return -E_NO_MEM;
 		}
 		env->env_ipc_perm = perm;
+		env->env_ipc_npages = 1;
 	}
 
 	env->env_status = ENV_RUNNABLE;
 	return 0;
-	panic("sys_ipc_try_send not implemented");
+}
+
+	int
+sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+{
+	return ipc_try_send_from(curenv, envid, value, srcva, perm);
+}
+
+// Vector sends.  Messages queued by sys_ipc_sendv are copied here,
+// one slot per env, since the sender's struct Ipcv may not be mapped
+// when the message is finally delivered.
+static struct Ipcv ipc_sendv_buf[NENV];
+
+// Check that src may send the page at srcva with perm, under the same
+// rules as sys_ipc_try_send, and return the page.
+	static int
+ipc_check_page(struct Env *src, void *srcva, unsigned perm, struct Page **pp_store)
+{
+	struct Page *pp;
+	pte_t *pte;
+
+	if ((uint64_t)srcva >= UTOP || PGOFF(srcva))
+		return -E_INVAL;
+	if (!(perm & PTE_U) || !(perm & PTE_P) || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	if (!(pp = page_lookup(src->env_pml4e, srcva, &pte)))
+		return -E_INVAL;
+	if ((perm & PTE_W) && !(*pte & PTE_W))
+		return -E_INVAL;
+	*pp_store = pp;
+	return 0;
+}
+
+// Deliver the vector message iv from src to envid, which must be
+// receiving.  The pages land contiguously from the receiver's dstva;
+// pages beyond its window are dropped, as a page is dropped for a
+// receiver that asked for none.  Either everything is delivered or
+// nothing is.  Guests can't use vector IPC.
+	static int
+ipc_try_sendv_from(struct Env *src, envid_t envid, const struct Ipcv *iv)
+{
+	struct Page *pp[IPC_MAXPAGES];
+	struct Env *dst;
+	uint32_t i, n;
+	int r;
+
+	if (envid2env(envid, &dst, 0) < 0)
+		return -E_BAD_ENV;
+	if (dst->env_status != ENV_NOT_RUNNABLE || !dst->env_ipc_recving)
+		return -E_IPC_NOT_RECV;
+	if (src->env_type == ENV_TYPE_GUEST || dst->env_type == ENV_TYPE_GUEST)
+		return -E_INVAL;
+	if (iv->iv_npages > IPC_MAXPAGES || iv->iv_len > IPC_INLINE)
+		return -E_INVAL;
+
+	for (i = 0; i < iv->iv_npages; i++)
+		if ((r = ipc_check_page(src, iv->iv_pages[i], iv->iv_perm, &pp[i])) < 0)
+			return r;
+
+	n = 0;
+	if ((uint64_t)dst->env_ipc_dstva < UTOP)
+		n = MIN(iv->iv_npages, dst->env_ipc_window);
+	// Get the page tables first, so the inserts can't fail partway and
+	// leave the window half replaced.
+	for (i = 0; i < n; i++)
+		if ((r = page_reserve(dst->env_pml4e, dst->env_ipc_dstva + i * PGSIZE)) < 0)
+			return r;
+	for (i = 0; i < n; i++) {
+		r = page_insert(dst->env_pml4e, pp[i], dst->env_ipc_dstva + i * PGSIZE, iv->iv_perm);
+		assert(r == 0);
+	}
+
+	memmove(dst->env_ipc_inline, iv->iv_inline, iv->iv_len);
+	dst->env_ipc_len = iv->iv_len;
+	dst->env_ipc_npages = n;
+	dst->env_ipc_perm = n ? iv->iv_perm : 0;
+	dst->env_ipc_value = iv->iv_value;
+	dst->env_ipc_from = src->env_id;
+	dst->env_ipc_recving = 0;
+	dst->env_status = ENV_RUNNABLE;
+	return 0;
+}
+
+// Alarms.  An env may arm one alarm at a time with sys_ipc_alarm.  When
+// it comes due the env receives a message from itself, carrying the
+// value it chose, the next time it is blocked receiving; nobody
+// else can send an env a message from itself, so the receiver can tell
+// an alarm from a request.  An alarm fires once and is then disarmed.
+
+// Number of envs with an alarm armed.
+static int ipc_nalarms;
+
+	static void
+ipc_alarm_disarm(struct Env *e)
+{
+	if (!e->env_ipc_alarm)
+		return;
+	e->env_ipc_alarm = 0;
+	ipc_nalarms--;
+}
+
+// Whether e's alarm has come due at time now.
+	static bool
+ipc_alarm_due(struct Env *e, uint32_t now)
+{
+	return e->env_ipc_alarm && (int32_t) (now - e->env_ipc_alarm) >= 0;
+}
+
+// Deliver e's alarm to e, which is blocked receiving.
+	static void
+ipc_alarm_deliver(struct Env *e)
+{
+	e->env_ipc_value = e->env_ipc_alarm_value;
+	e->env_ipc_from = e->env_id;
+	e->env_ipc_perm = 0;
+	e->env_ipc_npages = 0;
+	e->env_ipc_len = 0;
+	e->env_ipc_recving = 0;
+	e->env_tf.tf_regs.reg_rax = 0;
+	ipc_alarm_disarm(e);
+}
+
+// Arm curenv's alarm to deliver value at time_msec() == deadline,
+// replacing any alarm already armed.  A deadline of 0 just disarms.
+// Guests can't take alarms, as they don't receive with sys_ipc_recv.
+	static int
+sys_ipc_alarm(uint32_t deadline, uint32_t value)
+{
+	if (curenv->env_type == ENV_TYPE_GUEST)
+		return -E_INVAL;
+	ipc_alarm_disarm(curenv);
+	if (deadline) {
+		curenv->env_ipc_alarm = deadline;
+		curenv->env_ipc_alarm_value = value;
+		ipc_nalarms++;
+	}
+	return 0;
+}
+
+// Deliver the alarms that have come due to envs blocked receiving.
+// Called on every clock tick; cheap unless someone has an alarm armed.
+	void
+ipc_alarm_expire(void)
+{
+	uint32_t now;
+	int i, nalarms, narmed = 0;
+
+	if (!(nalarms = ipc_nalarms))
+		return;
+	now = time_msec();
+	for (i = 0; i < NENV; i++) {
+		if (envs[i].env_ipc_alarm)
+			narmed++;
+		if (ipc_alarm_due(&envs[i], now) && envs[i].env_ipc_recving
+		    && envs[i].env_status == ENV_NOT_RUNNABLE) {
+			ipc_alarm_deliver(&envs[i]);
+			envs[i].env_status = ENV_RUNNABLE;
+		}
+	}
+	// An alarm that outlived its env, or a count that drifted, would
+	// keep sched_yield polling for an alarm that never comes.
+	assert(narmed == nalarms);
+}
+
+// Whether some env has an alarm armed, for sched_yield.
+	bool
+ipc_alarm_has_armed(void)
+{
+	return ipc_nalarms > 0;
+}
+
+// Blocking sends.  A sender whose target isn't receiving is put at the
+// tail of the target's env_ipc_sendq and blocked.  When the target next
+// calls sys_ipc_recv it takes the message from the head of its queue
+// instead of blocking, so senders are served in arrival order.  A
+// queued sender is woken with the result of the delivery, with
+// -E_IPC_TIMEOUT if its deadline passes first, or with -E_BAD_ENV if
+// the target goes away.
+
+// Number of queued senders that have a deadline.
+static int ipc_nsend_timed;
+
+// Take e off the send queue it is waiting on.
+	static void
+ipc_sendq_remove(struct Env *e)
+{
+	struct Env *dst, **pp;
+
+	if (!e->env_ipc_send_to)
+		return;
+	if (envid2env(e->env_ipc_send_to, &dst, 0) == 0)
+		for (pp = &dst->env_ipc_sendq; *pp; pp = &(*pp)->env_ipc_sendq_next)
+			if (*pp == e) {
+				*pp = e->env_ipc_sendq_next;
+				break;
+			}
+	if (e->env_ipc_send_deadline)
+		ipc_nsend_timed--;
+	e->env_ipc_send_to = 0;
+	e->env_ipc_sendq_next = NULL;
+}
+
+// Finish the blocked send of e with result r.  After a successful
+// sys_ipc_call send, e goes on to wait for its reply.
+	static void
+ipc_send_done(struct Env *e, int r)
+{
+	ipc_sendq_remove(e);
+	e->env_tf.tf_regs.reg_rax = r;
+	if (r == 0 && e->env_ipc_send_call)
+		e->env_ipc_recving = 1;
+	else
+		e->env_status = ENV_RUNNABLE;
+}
+
+// Queue curenv's message on envid and block.  Returns -E_IPC_NOT_RECV
+// at once for targets that can't take queued messages (guests, which
+// receive through vmcall, and curenv itself).
+	static int
+ipc_send_block(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	       uint32_t timeout, bool call, bool vec)
+{
+	struct Env *dst, **pp;
+
+	if (envid2env(envid, &dst, 0) < 0)
+		return -E_BAD_ENV;
+	if (dst->env_type == ENV_TYPE_GUEST || dst == curenv)
+		return -E_IPC_NOT_RECV;
+
+	curenv->env_ipc_send_to = envid;
+	curenv->env_ipc_send_value = value;
+	curenv->env_ipc_send_srcva = srcva;
+	curenv->env_ipc_send_perm = perm;
+	curenv->env_ipc_send_call = call;
+	curenv->env_ipc_send_vec = vec;
+	curenv->env_ipc_send_deadline = 0;
+	if (timeout) {
+		curenv->env_ipc_send_deadline = MAX(time_msec() + timeout, 1);
+		ipc_nsend_timed++;
+	}
+
+	curenv->env_ipc_sendq_next = NULL;
+	for (pp = &dst->env_ipc_sendq; *pp; pp = &(*pp)->env_ipc_sendq_next)
+		/* find the tail */;
+	*pp = curenv;
+
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Deliver the oldest queued message to curenv, which is set up to
+// receive.  Senders whose message can't be delivered (say, the page
+// went away) get the error and the next one is tried.  Returns 1 if a
+// message was delivered.
+	static int
+ipc_recv_queued(void)
+{
+	struct Env *e;
+	int r;
+
+	while ((e = curenv->env_ipc_sendq)) {
+		if (e->env_ipc_send_vec)
+			r = ipc_try_sendv_from(e, curenv->env_id, &ipc_sendv_buf[ENVX(e->env_id)]);
+		else
+			r = ipc_try_send_from(e, curenv->env_id, e->env_ipc_send_value,
+					      e->env_ipc_send_srcva, e->env_ipc_send_perm);
+		ipc_send_done(e, r);
+		if (r == 0) {
+			curenv->env_status = ENV_RUNNING;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// e is being destroyed: leave the queue it waits on, and fail every
+// sender waiting on it.
+	void
+ipc_env_free(struct Env *e)
+{
+	ipc_sendq_remove(e);
+	while (e->env_ipc_sendq)
+		ipc_send_done(e->env_ipc_sendq, -E_BAD_ENV);
+	ipc_alarm_disarm(e);
+}
+
+// Fail queued senders whose deadline has passed.  Called on every
+// clock tick; cheap unless someone is waiting with a timeout.
+	void
+ipc_send_expire(void)
+{
+	uint32_t now;
+	int i;
+
+	if (!ipc_nsend_timed)
+		return;
+	now = time_msec();
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_ipc_send_to && envs[i].env_ipc_send_deadline
+		    && (int32_t) (now - envs[i].env_ipc_send_deadline) >= 0)
+			ipc_send_done(&envs[i], -E_IPC_TIMEOUT);
+}
+
+// Whether some env is blocked in a send that will time out, for sched_yield.
+	bool
+ipc_send_has_timed(void)
+{
+	return ipc_nsend_timed > 0;
+}
+
+// Send like sys_ipc_try_send, but if envid isn't receiving, wait in
+// its send queue until it is.  A nonzero timeout gives up after that
+// many milliseconds with -E_IPC_TIMEOUT.  Returns 0 on success, or any
+// error sys_ipc_try_send can return other than -E_IPC_NOT_RECV.
+	static int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     uint32_t timeout)
+{
+	int r;
+
+	if ((r = sys_ipc_try_send(envid, value, srcva, perm)) != -E_IPC_NOT_RECV)
+		return r;
+	return ipc_send_block(envid, value, srcva, perm, timeout, 0, 0);
+}
+
+// Send the vector message at iv to envid, waiting in its send queue
+// with an optional timeout just as sys_ipc_send does.  The receiver
+// gets the pages mapped contiguously from its dstva, up to its window
+// (see sys_ipc_recvv), and the inline bytes in env_ipc_inline.
+// Returns 0 on success, < 0 on error.
+	static int
+sys_ipc_sendv(envid_t envid, const struct Ipcv *iv, uint32_t timeout)
+{
+	struct Ipcv *kiv = &ipc_sendv_buf[ENVX(curenv->env_id)];
+	int r;
+
+	user_mem_assert(curenv, iv, sizeof(*iv), PTE_U | PTE_P);
+	*kiv = *iv;
+	if ((r = ipc_try_sendv_from(curenv, envid, kiv)) != -E_IPC_NOT_RECV)
+		return r;
+	return ipc_send_block(envid, kiv->iv_value, 0, 0, timeout, 0, 1);
 }
 
 // Block until a value is ready.  Record that you want to receive
@@ -489,8 +950,8 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // return 0 on success.
 // Return < 0 on error.  Errors are:
 //	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
-    int
-sys_ipc_recv(void *dstva)
+    static int
+ipc_recv_window(void *dstva, uint32_t window)
 {
         //cprintf("\nsys_ipc_recv 1\n");
 	if (!curenv)
@@ -515,6 +976,7 @@ sys_ipc_recv(void *dstva)
 	}
 	else*/
 		curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_window = window;
 
         //cprintf("\nsys_ipc_recv 5\n");
 	curenv->env_ipc_perm = 0;
@@ -524,11 +986,98 @@ sys_ipc_recv(void *dstva)
 
         //cprintf("\nsys_ipc_recv 6\n");
 	curenv->env_ipc_perm = 0;
+
+	// Our alarm may already be due, or someone may already be waiting
+	// to send to us.
+	if (ipc_alarm_due(curenv, time_msec())) {
+		ipc_alarm_deliver(curenv);
+		curenv->env_status = ENV_RUNNING;
+		return 0;
+	}
+	if (curenv->env_type != ENV_TYPE_GUEST && ipc_recv_queued())
+		return 0;
 	sched_yield(); //Give up the cpu. Don't return, instead env_run some other env.
     //panic("sys_ipc_recv not implemented");
     return 0;
 }
 
+    int
+sys_ipc_recv(void *dstva)
+{
+	return ipc_recv_window(dstva, 1);
+}
+
+// Like sys_ipc_recv, but be willing to take up to npages pages, which
+// are mapped contiguously from dstva.  Errors are:
+//	-E_INVAL if npages is 0 or more than IPC_MAXPAGES.
+//	-E_INVAL if dstva < UTOP but the window is not page-aligned or
+//		reaches past UTOP.
+	static int
+sys_ipc_recvv(void *dstva, uint32_t npages)
+{
+	if (npages == 0 || npages > IPC_MAXPAGES)
+		return -E_INVAL;
+	if ((uint64_t)dstva < UTOP
+	    && (PGOFF(dstva) || (uint64_t)dstva + npages * PGSIZE > UTOP))
+		return -E_INVAL;
+	return ipc_recv_window(dstva, npages);
+}
+
+// Switch straight to envid if an IPC just made it runnable, giving it
+// the rest of the current time slice instead of leaving it to wait for
+// its turn in sched_yield.  The caller must already have set curenv's
+// return value in its trapframe.  Returns only if envid can't be run
+// here (gone, not runnable, or a guest, which only sched_yield may
+// start).
+	static void
+ipc_handoff(envid_t envid)
+{
+	struct Env *e;
+
+	if (envid2env(envid, &e, 0) < 0 || e == curenv)
+		return;
+	if (e->env_status != ENV_RUNNABLE || e->env_type == ENV_TYPE_GUEST)
+		return;
+	env_run(e);
+}
+
+// Send to envid exactly as sys_ipc_try_send does and then wait for a
+// reply exactly as sys_ipc_recv does, in a single trap, switching
+// straight to envid.  We are already receiving when envid starts, so it
+// can reply at once.
+//
+// If envid isn't receiving yet, wait in its send queue as sys_ipc_send
+// does (without a timeout).  Returns < 0 if the send fails; otherwise
+// does not return, and the reply is delivered as for sys_ipc_recv.
+	static int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     void *dstva)
+{
+	int r;
+
+	if ((uint64_t)dstva < UTOP && PGOFF(dstva))
+		return -E_INVAL;
+
+	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_window = 1;
+	curenv->env_ipc_perm = 0;
+	curenv->env_ipc_from = 0;
+	curenv->env_ipc_recving = 1;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+
+	if ((r = sys_ipc_try_send(envid, value, srcva, perm)) < 0) {
+		curenv->env_ipc_recving = 0;
+		curenv->env_status = ENV_RUNNING;
+		if (r != -E_IPC_NOT_RECV)
+			return r;
+		return ipc_send_block(envid, value, srcva, perm, 0, 1, 0);
+	}
+
+	curenv->env_tf.tf_regs.reg_rax = 0;
+	ipc_handoff(envid);
+	sched_yield();
+}
+
 // Return the current time.
 int sys_time_msec(void)
 {
@@ -683,6 +1232,8 @@ syscall(uint64_t syscallno, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
     //cprintf("Syscall number : %x , %x %x %x %x", syscallno, a1, a2, a3, a4);
     //cprintf("Syscall number : %x", syscallno);
 
+    int r;
+
     switch (syscallno) {
     		case SYS_cputs:
     			sys_cputs((const char *)a1, (size_t) a2);
@@ -717,7 +1268,37 @@ syscall(uint64_t syscallno, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
     		case SYS_ipc_recv:
     			return sys_ipc_recv((void *)a1);
     		case SYS_ipc_try_send:
-    			return sys_ipc_try_send((envid_t) a1, (uint32_t) a2, (void *) a3, (unsigned) a4);
+    			if ((r = sys_ipc_try_send((envid_t) a1, (uint32_t) a2, (void *) a3, (unsigned) a4)) == 0) {
+    				curenv->env_tf.tf_regs.reg_rax = 0;
+    				ipc_handoff((envid_t) a1);
+    			}
+    			return r;
+    		case SYS_ipc_send:
+    			if ((r = sys_ipc_send((envid_t) a1, (uint32_t) a2, (void *) a3, (unsigned) a4, (uint32_t) a5)) == 0) {
+    				curenv->env_tf.tf_regs.reg_rax = 0;
+    				ipc_handoff((envid_t) a1);
+    			}
+    			return r;
+    		case SYS_ipc_sendv:
+    			if ((r = sys_ipc_sendv((envid_t) a1, (const struct Ipcv *) a2, (uint32_t) a3)) == 0) {
+    				curenv->env_tf.tf_regs.reg_rax = 0;
+    				ipc_handoff((envid_t) a1);
+    			}
+    			return r;
+    		case SYS_ipc_recvv:
+    			return sys_ipc_recvv((void *) a1, (uint32_t) a2);
+    		case SYS_fork_cow:
+    			return sys_fork_cow();
+    		case SYS_page_prezero:
+    			return page_prezero((int) a1);
+    		case SYS_ipc_alarm:
+    			return sys_ipc_alarm((uint32_t) a1, (uint32_t) a2);
+    		case SYS_futex_wait:
+    			return futex_wait((uint32_t *) a1, (uint32_t) a2, (uint32_t) a3);
+    		case SYS_futex_wake:
+    			return futex_wake((uint32_t *) a1, (uint32_t) a2);
+    		case SYS_ipc_call:
+    			return sys_ipc_call((envid_t) a1, (uint32_t) a2, (void *) a3, (unsigned) a4, (void *) a5);
     		case SYS_time_msec:
     			return sys_time_msec();
     		//todo: Network related system calls?
@@ -726,6 +1307,10 @@ syscall(uint64_t syscallno, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
 			return sys_env_transmit_packet(a1, (char*)a2, a3);
 		case SYS_env_receive_packet:
 			return sys_env_receive_packet(a1, (char*)a2, (size_t*)a3);
+		case SYS_ide_dma_attach:
+			return sys_ide_dma_attach();
+		case SYS_ide_wait_intr:
+			return sys_ide_wait_intr();
     		default:
     			return -E_NO_SYS;
     }
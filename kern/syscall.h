@@ -5,11 +5,17 @@
 #endif
 
 #include <inc/syscall.h>
+#include <inc/env.h>
 
 int64_t syscall(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5);
 
 int sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm);
 int sys_ipc_recv(void *dstva);
+void ipc_env_free(struct Env *e);
+void ipc_send_expire(void);
+bool ipc_send_has_timed(void);
+void ipc_alarm_expire(void);
+bool ipc_alarm_has_armed(void);
 	int
 sys_env_transmit_packet(envid_t envid, const char *data, size_t len);
 	int
@@ -1,6 +1,8 @@
 #include <inc/mmu.h>
 #include <inc/x86.h>
 #include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/error.h>
 
 #include <kern/pmap.h>
 #include <kern/trap.h>
@@ -14,6 +16,8 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
+#include <kern/ide.h>
+#include <kern/futex.h>
 
 #define DTRAP(name) \
 	extern void trap_##name()
@@ -283,6 +287,9 @@ trap_dispatch(struct Trapframe *tf)
 if(tf->tf_trapno == T_IRQ0) {
 		lapic_eoi();
 		time_tick();
+		ipc_send_expire();
+		ipc_alarm_expire();
+		futex_expire();
 		sched_yield();
 		return;
 	}
@@ -303,6 +310,10 @@ if(tf->tf_trapno == T_IRQ0) {
 		serial_intr();
 		return;
 	}
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_IDE) {
+		ide_intr();
+		return;
+	}
 
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
@@ -372,6 +383,46 @@ trap(struct Trapframe *tf)
 }
 
 
+// Give e a private, writable copy of the copy-on-write page at va.
+// A copy-on-write superpage is always copied whole here, since user
+// fault handlers only deal in small pages; small pages only if
+// 'small' is set.
+// Returns 0 on success, < 0 if va isn't a copy-on-write page or
+// memory ran out.
+static int
+cow_break(struct Env *e, uintptr_t va, bool small)
+{
+	struct Page *pp, *np;
+	pte_t *pte;
+	int perm;
+
+	if (va >= UTOP || !(pp = page_lookup(e->env_pml4e, (void *) va, &pte))
+	    || (*pte & (PTE_U|PTE_COW)) != (PTE_U|PTE_COW))
+		return -E_INVAL;
+	if (*pte & PTE_PS) {
+		if (!(np = page_alloc_order(PAGE_HUGE_ORDER, 0)))
+			return -E_NO_MEM;
+		memcpy(page2kva(np), page2kva(page_head(pp)), PTSIZE);
+		perm = (*pte & PTE_SYSCALL & ~PTE_COW) | PTE_W | PTE_PS;
+		if (page_insert(e->env_pml4e, np, ROUNDDOWN((void *) va, PTSIZE), perm) < 0) {
+			page_free(np);
+			return -E_NO_MEM;
+		}
+		return 0;
+	}
+	if (!small)
+		return -E_INVAL;
+	if (!(np = page_alloc(0)))
+		return -E_NO_MEM;
+	memcpy(page2kva(np), page2kva(pp), PGSIZE);
+	perm = (*pte & PTE_SYSCALL & ~PTE_COW) | PTE_W;
+	if (page_insert(e->env_pml4e, np, ROUNDDOWN((void *) va, PGSIZE), perm) < 0) {
+		page_free(np);
+		return -E_NO_MEM;
+	}
+	return 0;
+}
+
 void
 page_fault_handler(struct Trapframe *tf)
 {
@@ -421,6 +472,15 @@ page_fault_handler(struct Trapframe *tf)
 	//   (the 'tf' variable points at 'curenv->env_tf').
 
 	// LAB 4: Your code here.
+
+	// A spawned program starts with its data segment copy-on-write
+	// (see lib/spawn.c) and no handler of its own yet, so the kernel
+	// breaks copy-on-write for envs without an upcall.  Superpages
+	// are left to the kernel either way.
+	if ((tf->tf_err & FEC_WR)
+	    && cow_break(curenv, fault_va, !curenv->env_pgfault_upcall) == 0)
+		env_run(curenv);
+
     if(curenv->env_pgfault_upcall) {
         uintptr_t xrsp = UXSTACKTOP;
 
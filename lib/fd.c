@@ -6,14 +6,14 @@
 #define MAXFD		32
 // Bottom of file descriptor area
 #define FDTABLE		0xD0000000
-// Bottom of file data area.  We reserve one data page for each FD,
-// which devices can use if they choose.
+// Bottom of file data area.  We reserve FDDATAPAGES data pages for
+// each FD, which devices can use if they choose.
 #define FILEDATA	(FDTABLE + MAXFD*PGSIZE)
 
 // Return the 'struct Fd*' for file descriptor index i
 #define INDEX2FD(i)	((struct Fd*) (FDTABLE + ((uint64_t)i)*PGSIZE))
-// Return the file data page for file descriptor index i
-#define INDEX2DATA(i)	((char*) (FILEDATA + (i)*PGSIZE))
+// Return the file data area for file descriptor index i
+#define INDEX2DATA(i)	((char*) (FILEDATA + (i)*FDDATAPAGES*PGSIZE))
 
 
 // --------------------------------------------------------------
@@ -177,7 +177,7 @@ close_all(void)
 int
 dup(int oldfdnum, int newfdnum)
 {
-	int r;
+	int i, r;
 	char *ova, *nva;
 	pte_t pte;
 	struct Fd *oldfd, *newfd;
@@ -190,9 +190,10 @@ dup(int oldfdnum, int newfdnum)
 	ova = fd2data(oldfd);
 	nva = fd2data(newfd);
 
-	if ((vpd[VPD(ova)] & PTE_P) && (vpt[VPN(ova)] & PTE_P))
-		if ((r = sys_page_map(0, ova, 0, nva, vpt[VPN(ova)] & PTE_SYSCALL)) < 0)
-			goto err;
+	for (i = 0; i < FDDATAPAGES; i++, ova += PGSIZE, nva += PGSIZE)
+		if ((vpd[VPD(ova)] & PTE_P) && (vpt[VPN(ova)] & PTE_P))
+			if ((r = sys_page_map(0, ova, 0, nva, vpt[VPN(ova)] & PTE_SYSCALL)) < 0)
+				goto err;
 	if ((r = sys_page_map(0, oldfd, 0, newfd, vpt[VPN(oldfd)] & PTE_SYSCALL)) < 0)
 		goto err;
 
@@ -200,7 +201,8 @@ dup(int oldfdnum, int newfdnum)
 
 err:
 	sys_page_unmap(0, newfd);
-	sys_page_unmap(0, nva);
+	for (nva = fd2data(newfd), i = 0; i < FDDATAPAGES; i++, nva += PGSIZE)
+		sys_page_unmap(0, nva);
 	return r;
 }
 
@@ -16,20 +16,36 @@ union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 // type: request code, passed as the simple integer IPC value.
 // dstva: virtual address at which to receive reply page, 0 if none.
 // Returns result from the file server.
-static int
-fsipc(unsigned type, void *dstva)
+static envid_t
+fsipc_env(void)
 {
 	static envid_t fsenv;
 	if (fsenv == 0)
 		fsenv = ipc_find_env(ENV_TYPE_FS);
+	return fsenv;
+}
+
+static int
+fsipc(unsigned type, void *dstva)
+{
+	envid_t fsenv = fsipc_env();
 
 	//static_assert(sizeof(fsipcbuf) == PGSIZE);
 
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	return ipc_call(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U,
+			dstva, NULL, NULL);
+}
+
+// Like fsipc, but take up to 'npages' reply pages, mapped from 'dstva'.
+// The number of pages received is stored in *npages_store.
+static int
+fsipcv(unsigned type, void *dstva, unsigned npages, unsigned *npages_store)
+{
+	ipc_send(fsipc_env(), type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
+	return ipc_recvv(NULL, dstva, npages, npages_store, NULL);
 }
 
 static int devfile_flush(struct Fd *fd);
@@ -177,6 +193,212 @@ devfile_trunc(struct Fd *fd, off_t newsize)
 	return fsipc(FSREQ_SET_SIZE, NULL);
 }
 
+// Map up to 'len' bytes of the open file 'fdnum', starting at the
+// page-aligned 'offset', read-only at the page-aligned address 'va'.
+// The pages are the file server's block-cache pages themselves, so
+// nothing is copied and later writes to the file show through.  Each
+// FSREQ_MAP round trip brings in up to IPC_MAXPAGES pages.
+//
+// Returns:
+//	The number of bytes of file data mapped, which is less than
+//	'len' if the file ends first.  The tail of the last page past
+//	that count is not file data.
+//	< 0 on error, in which case nothing stays mapped.
+int
+mmap(void *va, size_t len, int fdnum, off_t offset)
+{
+	struct Fd *fd;
+	size_t done;
+	unsigned npages, got;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	if ((uintptr_t) va % PGSIZE || offset % PGSIZE
+	    || (uintptr_t) va + len > UTOP)
+		return -E_INVAL;
+
+	for (done = 0; done < len; done += npages * PGSIZE) {
+		npages = MIN(ROUNDUP(len - done, PGSIZE) / PGSIZE, IPC_MAXPAGES);
+		fsipcbuf.map.req_fileid = fd->fd_file.id;
+		fsipcbuf.map.req_offset = offset + done;
+		fsipcbuf.map.req_npages = npages;
+		if ((r = fsipcv(FSREQ_MAP, va + done, npages, &got)) < 0) {
+			munmap(va, done);
+			return r;
+		}
+		if (r < npages * PGSIZE)
+			return MIN(done + r, len);
+	}
+	return len;
+}
+
+// Unmap pages mapped by mmap.
+int
+munmap(void *va, size_t len)
+{
+	size_t off;
+	int r;
+
+	if ((uintptr_t) va % PGSIZE)
+		return -E_INVAL;
+	for (off = 0; off < len; off += PGSIZE)
+		if ((r = sys_page_unmap(0, va + off)) < 0)
+			return r;
+	return 0;
+}
+
+// Asynchronous requests.  Each env sets up one request ring with the
+// file server (see inc/fs.h) the first time it queues something.  The
+// fsring_* calls queue a request and return a ticket; fsring_reap
+// returns results in the order the requests were queued, kicking the
+// server with a single IPC only when the oldest result isn't ready yet.
+#define FSRINGVA	((struct Fsring *) 0xE0000000)
+
+static envid_t fsring_env;	// env owning the ring; a forked child sets up its own
+static uint32_t fsring_tail;	// next slot to fill
+static uint32_t fsring_reaped;	// next slot to reap
+static struct {
+	void *buf;		// where FSREQ_READ data goes
+	struct Stat *st;	// where FSREQ_STAT results go
+} fsring_dst[FSRING_NENT];
+
+static union Fsipc *
+fsring_slot(uint32_t i)
+{
+	return (union Fsipc *) ((char *) FSRINGVA + (1 + i % FSRING_NENT) * PGSIZE);
+}
+
+static int
+fsring_setup(void)
+{
+	int i, r;
+
+	if (fsring_env == thisenv->env_id)
+		return 0;
+	for (i = 0; i < FSRING_NPAGES; i++) {
+		fsipcbuf.ring.req_page = i;
+		if ((r = fsipc(FSREQ_RING, (char *) FSRINGVA + i * PGSIZE)) < 0)
+			return r;
+	}
+	fsring_env = thisenv->env_id;
+	fsring_tail = fsring_reaped = 0;
+	return 0;
+}
+
+// Claim the next free slot for a request on 'fdnum'.  Returns -E_NO_MEM
+// if FSRING_NENT requests are already waiting to be reaped.
+static int
+fsring_get(int fdnum, union Fsipc **slot, int *fileid)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	if ((r = fsring_setup()) < 0)
+		return r;
+	if (fsring_tail - fsring_reaped == FSRING_NENT)
+		return -E_NO_MEM;
+
+	*slot = fsring_slot(fsring_tail);
+	*fileid = fd->fd_file.id;
+	fsring_dst[fsring_tail % FSRING_NENT].buf = 0;
+	fsring_dst[fsring_tail % FSRING_NENT].st = 0;
+	return 0;
+}
+
+// Hand the slot filled by the last fsring_get to the server.
+static int
+fsring_put(int type)
+{
+	FSRINGVA->fr_ent[fsring_tail % FSRING_NENT].fe_type = type;
+	FSRINGVA->fr_sq_tail = ++fsring_tail;
+	return (fsring_tail - 1) & 0x7FFFFFFF;
+}
+
+// Queue a read of at most 'n' bytes from the seek position of 'fdnum'
+// into 'buf'.  Returns a ticket, or < 0 on error.
+int
+fsring_read(int fdnum, void *buf, size_t n)
+{
+	union Fsipc *slot;
+	int r, fileid;
+
+	if ((r = fsring_get(fdnum, &slot, &fileid)) < 0)
+		return r;
+	slot->read.req_fileid = fileid;
+	slot->read.req_n = MIN(n, PGSIZE);
+	fsring_dst[fsring_tail % FSRING_NENT].buf = buf;
+	return fsring_put(FSREQ_READ);
+}
+
+// Queue a write of at most 'n' bytes from 'buf' at the seek position.
+// Returns a ticket, or < 0 on error.
+int
+fsring_write(int fdnum, const void *buf, size_t n)
+{
+	union Fsipc *slot;
+	int r, fileid;
+
+	if ((r = fsring_get(fdnum, &slot, &fileid)) < 0)
+		return r;
+	n = MIN(n, sizeof(slot->write.req_buf));
+	slot->write.req_fileid = fileid;
+	slot->write.req_n = n;
+	memmove(slot->write.req_buf, buf, n);
+	return fsring_put(FSREQ_WRITE);
+}
+
+// Queue a stat of 'fdnum' into 'st'.  Returns a ticket, or < 0 on error.
+int
+fsring_stat(int fdnum, struct Stat *st)
+{
+	union Fsipc *slot;
+	int r, fileid;
+
+	if ((r = fsring_get(fdnum, &slot, &fileid)) < 0)
+		return r;
+	slot->stat.req_fileid = fileid;
+	fsring_dst[fsring_tail % FSRING_NENT].st = st;
+	return fsring_put(FSREQ_STAT);
+}
+
+// Wait for the oldest queued request and return its result, storing its
+// ticket in *ticket if 'ticket' is nonnull.  Returns -E_INVAL if nothing
+// is queued.
+int
+fsring_reap(int *ticket)
+{
+	union Fsipc *slot;
+	uint32_t i = fsring_reaped;
+	int r;
+
+	if (fsring_env != thisenv->env_id || i == fsring_tail)
+		return -E_INVAL;
+	while ((int32_t) (FSRINGVA->fr_sq_head - i) <= 0)
+		if ((r = fsipc(FSREQ_RING_KICK, NULL)) < 0)
+			return r;
+
+	slot = fsring_slot(i);
+	r = FSRINGVA->fr_ent[i % FSRING_NENT].fe_result;
+	if (fsring_dst[i % FSRING_NENT].buf && r > 0)
+		memmove(fsring_dst[i % FSRING_NENT].buf, slot->readRet.ret_buf, r);
+	if (fsring_dst[i % FSRING_NENT].st && r == 0) {
+		strcpy(fsring_dst[i % FSRING_NENT].st->st_name, slot->statRet.ret_name);
+		fsring_dst[i % FSRING_NENT].st->st_size = slot->statRet.ret_size;
+		fsring_dst[i % FSRING_NENT].st->st_isdir = slot->statRet.ret_isdir;
+	}
+	if (ticket)
+		*ticket = i & 0x7FFFFFFF;
+	fsring_reaped = i + 1;
+	return r;
+}
+
 // Delete a file
 int
 remove(const char *path)
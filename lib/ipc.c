@@ -51,32 +51,107 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 }
 
 // Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
-// This function keeps trying until it succeeds.
+// The kernel queues us behind any earlier senders until 'toenv' is
+// receiving, so this doesn't spin.  Only targets that can't queue
+// senders (VM guests) still get the sys_yield retry loop.
 // It should panic() on any error other than -E_IPC_NOT_RECV.
 //
 // Hint:
-//   Use sys_yield() to be CPU-friendly.
 //   If 'pg' is null, pass sys_ipc_recv a value that it will understand
 //   as meaning "no page".  (Zero is not the right value.)
     void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 {
-    //If pg is NULL, then set pg to something that sys_ipc_rev can decode
-        if (pg == NULL)
-                pg=(void*)UTOP;
-
-	//Loop until succeeded/
-	while (1) {
-		//Try sending the value to dst
-		int r = sys_ipc_try_send(to_env, val, pg, perm);
-
-		if (r == 0)
-			break;
-		if (r < 0 && r != -E_IPC_NOT_RECV) //Receiver is not ready to receive.
-			panic("error in sys_ipc_try_send %e\n", r);
-		else if (r == -E_IPC_NOT_RECV) 
-			sys_yield();
+	int r;
+
+	if ((r = ipc_send_timeout(to_env, val, pg, perm, 0)) < 0)
+		panic("error in sys_ipc_send %e\n", r);
+}
+
+// Like ipc_send, but give up with -E_IPC_TIMEOUT if 'to_env' hasn't
+// taken the message within 'timeout' milliseconds (0 waits forever).
+// Returns 0 on success, < 0 on error.
+    int
+ipc_send_timeout(envid_t to_env, uint32_t val, void *pg, int perm, unsigned timeout)
+{
+	int r;
+
+	if (pg == NULL)
+		pg = (void *) UTOP;
+
+	while ((r = sys_ipc_send(to_env, val, pg, perm, timeout)) == -E_IPC_NOT_RECV)
+		sys_yield();
+	return r;
+}
+
+// Send the vector message 'iv' (see inc/env.h) to 'to_env', waiting
+// until it is received.  Panics on any error.
+    void
+ipc_sendv(envid_t to_env, const struct Ipcv *iv)
+{
+	int r;
+
+	if ((r = sys_ipc_sendv(to_env, iv, 0)) < 0)
+		panic("error in sys_ipc_sendv %e\n", r);
+}
+
+// Receive a message as ipc_recv does, but take up to 'npages' pages,
+// mapped contiguously from 'pg'.  The number of pages actually mapped
+// is stored in *npages_store; any inline data is in
+// thisenv->env_ipc_inline, thisenv->env_ipc_len bytes of it.
+    int32_t
+ipc_recvv(envid_t *from_env_store, void *pg, unsigned npages,
+	  unsigned *npages_store, int *perm_store)
+{
+	int r;
+
+	if (pg == NULL)
+		pg = (void *) UTOP;
+
+	if ((r = sys_ipc_recvv(pg, npages)) < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (npages_store)
+			*npages_store = 0;
+		if (perm_store)
+			*perm_store = 0;
+		return r;
 	}
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (npages_store)
+		*npages_store = thisenv->env_ipc_npages;
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
+}
+
+// Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'to_env' and
+// wait for the reply, as ipc_send followed by ipc_recv would, but in one
+// system call that runs 'to_env' right away.  'rcv_pg', 'from_env_store'
+// and 'perm_store' are as for ipc_recv.  Keeps trying until 'to_env' is
+// receiving; panics on any other send error.
+    int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+	 void *rcv_pg, envid_t *from_env_store, int *perm_store)
+{
+	int r;
+
+	if (pg == NULL)
+		pg = (void *) UTOP;
+	if (rcv_pg == NULL)
+		rcv_pg = (void *) UTOP;
+
+	while ((r = sys_ipc_call(to_env, val, pg, perm, rcv_pg)) == -E_IPC_NOT_RECV)
+		sys_yield();
+	if (r < 0)
+		panic("error in sys_ipc_call %e\n", r);
+
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
 }
 
 #ifdef VMM_GUEST
@@ -1,136 +1,405 @@
-
 #include <inc/lib.h>
 
 /*
- * Simple malloc/free.
+ * Size-class slab malloc/free.
+ *
+ * Small requests (up to SLAB_MAXOBJ bytes) are rounded up to one of
+ * a few size classes.  Each class carves one-page slabs into equal
+ * objects and keeps the slabs that still have free objects on a
+ * list, so freed objects are reused right away.  A slab starts with
+ * a struct Slab header, which is how free() finds it: small objects
+ * are never page-aligned.
  *
- * Uses the address space to do most of the hard work.
- * The address space from mbegin to mend is scanned
- * in order.  Pages are allocated, used to fill successive
- * malloc requests, and then left alone.  Free decrements
- * a ref count maintained in the page; the page is freed
- * when the ref count hits zero.
+ * Larger requests get a span of whole pages of their own, returned
+ * page-aligned, and unmapped again by free().
  *
- * If we need to allocate a large amount (more than a page)
- * we can't put a ref count at the end of each page,
- * so we mark the pte entry with the bit PTE_CONTINUED.
+ * Address space from mbegin to mend is handed out a page at a time.
+ * Its first two pages hold bitmaps of the pages in use and of the
+ * pages that start a slab or span, which is all free() needs to know
+ * a span's length.
+ *
+ * A thread package can also register a per-thread cache of recently
+ * freed small objects (malloc_set_cache), so that alloc/free churn
+ * within a thread stays off the shared slab lists.
  */
 
-#define PTE_CONTINUED 0x400
+#define debug		0
 
 static uint8_t *mbegin = (uint8_t*) 0x08000000;
 static uint8_t *mend   = (uint8_t*) 0x10000000;
-static uint8_t *mptr;
 
-static int
-isfree(void *v, size_t n)
+#define MPAGES		((uint32_t) ((mend - mbegin) / PGSIZE))
+#define MPAGE2VA(i)	(mbegin + (uintptr_t) (i) * PGSIZE)
+#define MVA2PAGE(v)	((uint32_t) (((uint8_t *) (v) - mbegin) / PGSIZE))
+
+// Bitmaps at the start of the arena, one bit per page.
+static uint64_t *mused;		// page is reserved
+static uint64_t *mstart;	// page starts a slab or span
+static uint32_t mrover;		// where to start looking for free pages
+
+#define SLAB_MAGIC	0x51ab51ab
+
+struct Slab {
+    uint32_t s_magic;
+    uint16_t s_class;
+    uint16_t s_nfree;		// free objects in this slab
+    void *s_free;		// free objects, linked through their first word
+    struct Slab *s_next;	// on the class's list of slabs with room
+    struct Slab *s_prev;
+};
+
+#define SLAB_HDRSIZE	ROUNDUP(sizeof(struct Slab), 16)
+
+// Object sizes, chosen so a page holds a whole number of them with
+// little left over after the header.  All are multiples of 16.
+static const uint16_t class_size[MCACHE_NCLASS] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 672, 1008, 2032
+};
+
+#define SLAB_MAXOBJ	2032
+
+struct SizeClass {
+    struct Slab *c_slabs;	// slabs with free objects
+    int c_nempty;		// how many of those are entirely free
+};
+
+static struct SizeClass classes[MCACHE_NCLASS];
+
+static struct malloc_cache *(*mcache_get)(void);
+
+    static inline bool
+mbit(uint64_t *map, uint32_t i)
 {
-    uintptr_t va, end_va = (uintptr_t) v + n;
+    return (map[i / 64] >> (i % 64)) & 1;
+}
 
-    for (va = (uintptr_t) v; va < end_va; va += PGSIZE)
-        if (va >= (uintptr_t) mend
-                || ((vpd[VPD(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P)))
-            return 0;
-    return 1;
+    static inline void
+mbit_set(uint64_t *map, uint32_t i, bool on)
+{
+    if (on)
+        map[i / 64] |= 1ULL << (i % 64);
+    else
+        map[i / 64] &= ~(1ULL << (i % 64));
 }
 
-    void*
-malloc(size_t n)
+    static int
+malloc_init(void)
 {
-    int i, cont;
-    int nwrap;
-    uint32_t *ref;
-    void *v;
+    int r;
 
-    if (mptr == 0)
-        mptr = mbegin;
+    static_assert(sizeof(struct Slab) <= 32);
 
-    n = ROUNDUP(n, 4);
+    mused = (uint64_t *) mbegin;
+    mstart = (uint64_t *) (mbegin + PGSIZE);
+    if ((r = sys_page_alloc(0, mused, PTE_P|PTE_U|PTE_W)) < 0
+            || (r = sys_page_alloc(0, mstart, PTE_P|PTE_U|PTE_W)) < 0) {
+        sys_page_unmap(0, mused);
+        mused = 0;
+        return r;
+    }
+    mbit_set(mused, 0, 1);
+    mbit_set(mused, 1, 1);
+    mbit_set(mstart, 0, 1);
+    mbit_set(mstart, 1, 1);
+    mrover = 2;
+    return 0;
+}
 
-    if (n >= MAXMALLOC)
+// Reserve and map npages contiguous pages of the arena.
+// Returns their address, or 0 if out of address space or memory.
+    static void *
+mpages_alloc(uint32_t npages)
+{
+    uint32_t i, run, start, scanned;
+    int r;
+
+    if (!mused && malloc_init() < 0)
         return 0;
 
-    if ((uintptr_t) mptr % PGSIZE){
-        /*
-         * we're in the middle of a partially
-         * allocated page - can we add this chunk?
-         * the +4 below is for the ref count.
-         */
-        ref = (uint32_t*) (ROUNDUP(mptr, PGSIZE) - 4);
-        if ((uintptr_t) mptr / PGSIZE == (uintptr_t) (mptr + n - 1 + 4) / PGSIZE) {
-            (*ref)++;
-            v = mptr;
-            mptr += n;
-            return v;
+    // First fit, starting at the rover and wrapping once.
+    run = 0;
+    start = i = mrover;
+    for (scanned = 0; scanned < MPAGES + npages; scanned++, i++) {
+        if (i == MPAGES) {
+            i = 0;
+            run = 0;
+        }
+        if (run == 0 && i % 64 == 0 && mused[i / 64] == ~0ULL) {
+            // skip a full word at once
+            i += 63;
+            scanned += 63;
+            continue;
+        }
+        if (mbit(mused, i)) {
+            run = 0;
+            continue;
+        }
+        // Someone else may have mapped pages here behind our back.
+        if ((vpd[VPD(MPAGE2VA(i))] & PTE_P) && (vpt[VPN(MPAGE2VA(i))] & PTE_P)) {
+            mbit_set(mused, i, 1);
+            mbit_set(mstart, i, 1);
+            run = 0;
+            continue;
         }
-        /*
-         * stop working on this page and move on.
-         */
-        free(mptr);	/* drop reference to this page */
-        mptr = ROUNDDOWN(mptr + PGSIZE, PGSIZE);
+        if (run++ == 0)
+            start = i;
+        if (run == npages)
+            goto found;
     }
+    return 0;	/* out of address space */
 
-    /*
-     * now we need to find some address space for this chunk.
-     * if it's less than a page we leave it open for allocation.
-     * runs of more than a page can't have ref counts so we
-     * flag the PTE entries instead.
-     */
-    nwrap = 0;
-    while (1) {
-        if (isfree(mptr, n + 4))
-            break;
-        mptr += PGSIZE;
-        if (mptr == mend) {
-            mptr = mbegin;
-            if (++nwrap == 2)
-                return 0;	/* out of address space */
+found:
+    for (i = 0; i < npages; i++)
+        if ((r = sys_page_alloc(0, MPAGE2VA(start + i), PTE_P|PTE_U|PTE_W)) < 0) {
+            while (i-- > 0)
+                sys_page_unmap(0, MPAGE2VA(start + i));
+            return 0;	/* out of physical memory */
         }
+    for (i = 0; i < npages; i++) {
+        mbit_set(mused, start + i, 1);
+        mbit_set(mstart, start + i, i == 0);
     }
+    mrover = start + npages;
+    if (mrover == MPAGES)
+        mrover = 0;
+    return MPAGE2VA(start);
+}
 
-    /*
-     * allocate at mptr - the +4 makes sure we allocate a ref count.
-     */
-    for (i = 0; i < n + 4; i += PGSIZE){
-        cont = (i + PGSIZE < n + 4) ? PTE_CONTINUED : 0;
-        if (sys_page_alloc(0, mptr + i, PTE_P|PTE_U|PTE_W|cont) < 0){
-            for (; i >= 0; i -= PGSIZE)
-                sys_page_unmap(0, mptr + i);
-            return 0;	/* out of physical memory */
+// Number of pages in the slab or span starting at page i.
+    static uint32_t
+mpages_len(uint32_t i)
+{
+    uint32_t n = 1;
+
+    while (i + n < MPAGES && mbit(mused, i + n) && !mbit(mstart, i + n))
+        n++;
+    return n;
+}
+
+    static void
+mpages_free(void *v, uint32_t npages)
+{
+    uint32_t i, p = MVA2PAGE(v);
+
+    for (i = 0; i < npages; i++) {
+        sys_page_unmap(0, MPAGE2VA(p + i));
+        mbit_set(mused, p + i, 0);
+        mbit_set(mstart, p + i, 0);
+    }
+}
+
+    static int
+size2class(size_t n)
+{
+    int c;
+
+    for (c = 0; c < MCACHE_NCLASS; c++)
+        if (n <= class_size[c])
+            return c;
+    return -1;
+}
+
+    static void
+slab_unlink(struct SizeClass *sc, struct Slab *s)
+{
+    if (s->s_prev)
+        s->s_prev->s_next = s->s_next;
+    else
+        sc->c_slabs = s->s_next;
+    if (s->s_next)
+        s->s_next->s_prev = s->s_prev;
+    s->s_next = s->s_prev = 0;
+}
+
+    static void
+slab_push(struct SizeClass *sc, struct Slab *s)
+{
+    s->s_prev = 0;
+    s->s_next = sc->c_slabs;
+    if (sc->c_slabs)
+        sc->c_slabs->s_prev = s;
+    sc->c_slabs = s;
+}
+
+    static inline int
+slab_nobj(int c)
+{
+    return (PGSIZE - SLAB_HDRSIZE) / class_size[c];
+}
+
+    static void *
+slab_alloc(int c)
+{
+    struct SizeClass *sc = &classes[c];
+    struct Slab *s;
+    uint8_t *obj;
+    int i;
+
+    if (!(s = sc->c_slabs)) {
+        if (!(s = mpages_alloc(1)))
+            return 0;
+        s->s_magic = SLAB_MAGIC;
+        s->s_class = c;
+        s->s_nfree = slab_nobj(c);
+        s->s_free = 0;
+        for (i = s->s_nfree - 1; i >= 0; i--) {
+            obj = (uint8_t *) s + SLAB_HDRSIZE + i * class_size[c];
+            *(void **) obj = s->s_free;
+            s->s_free = obj;
         }
+        slab_push(sc, s);
+        sc->c_nempty++;
+    }
+
+    if (s->s_nfree == slab_nobj(c))
+        sc->c_nempty--;
+    obj = s->s_free;
+    s->s_free = *(void **) obj;
+    if (--s->s_nfree == 0)
+        slab_unlink(sc, s);
+    return obj;
+}
+
+    static void
+slab_free(struct Slab *s, void *v)
+{
+    struct SizeClass *sc = &classes[s->s_class];
+
+    if (s->s_nfree == 0)
+        slab_push(sc, s);
+    *(void **) v = s->s_free;
+    s->s_free = v;
+    if (++s->s_nfree < slab_nobj(s->s_class))
+        return;
+
+    // Keep one free slab per class around; give back the rest.
+    if (sc->c_nempty == 0) {
+        sc->c_nempty++;
+        return;
     }
+    slab_unlink(sc, s);
+    s->s_magic = 0;
+    mpages_free(s, 1);
+}
 
-    ref = (uint32_t*) (mptr + i - 4);
-    *ref = 2;	/* reference for mptr, reference for returned block */
-    v = mptr;
-    mptr += n;
+    static struct Slab *
+v2slab(void *v)
+{
+    struct Slab *s = ROUNDDOWN(v, PGSIZE);
+
+    assert(s->s_magic == SLAB_MAGIC);
+    return s;
+}
+
+    void*
+malloc(size_t n)
+{
+    struct malloc_cache *mc;
+    void *v;
+    int c;
+
+    if (n >= MAXMALLOC)
+        return 0;
+    if (n == 0)
+        n = 1;
+
+    if ((c = size2class(n)) < 0)
+        v = mpages_alloc(ROUNDUP(n, PGSIZE) / PGSIZE);
+    else if (mcache_get && (mc = mcache_get()) && mc->mc_n[c] > 0)
+        v = mc->mc_obj[c][--mc->mc_n[c]];
+    else
+        v = slab_alloc(c);
+
+    if (debug)
+        cprintf("malloc %d -> %p\n", n, v);
     return v;
 }
 
     void
 free(void *v)
 {
-    uint8_t *c;
-    uint32_t *ref;
+    struct malloc_cache *mc;
+    struct Slab *s;
 
     if (v == 0)
         return;
     assert(mbegin <= (uint8_t*) v && (uint8_t*) v < mend);
 
-    c = ROUNDDOWN(v, PGSIZE);
+    if ((uintptr_t) v % PGSIZE == 0) {
+        assert(mbit(mstart, MVA2PAGE(v)));
+        mpages_free(v, mpages_len(MVA2PAGE(v)));
+        return;
+    }
+
+    s = v2slab(v);
+    if (mcache_get && (mc = mcache_get())
+            && mc->mc_n[s->s_class] < MCACHE_DEPTH) {
+        mc->mc_obj[s->s_class][mc->mc_n[s->s_class]++] = v;
+        return;
+    }
+    slab_free(s, v);
+}
+
+    void *
+calloc(size_t nmemb, size_t size)
+{
+    void *v;
+
+    if (size && nmemb > MAXMALLOC / size)
+        return 0;
+    if ((v = malloc(nmemb * size)))
+        memset(v, 0, nmemb * size);
+    return v;
+}
 
-    while (vpt[PPN(c)] & PTE_CONTINUED) {
-        sys_page_unmap(0, c);
-        c += PGSIZE;
-        assert(mbegin <= c && c < mend);
+    void *
+realloc(void *v, size_t n)
+{
+    size_t have;
+    void *nv;
+
+    if (v == 0)
+        return malloc(n);
+    if (n == 0) {
+        free(v);
+        return 0;
     }
 
-    /*
-     * c is just a piece of this page, so dec the ref count
-     * and maybe free the page.
-     */
-    ref = (uint32_t*) (c + PGSIZE - 4);
-    if (--(*ref) == 0)
-        sys_page_unmap(0, c);
+    assert(mbegin <= (uint8_t*) v && (uint8_t*) v < mend);
+    if ((uintptr_t) v % PGSIZE == 0)
+        have = mpages_len(MVA2PAGE(v)) * PGSIZE;
+    else
+        have = class_size[v2slab(v)->s_class];
+    // Shrink in place unless it would strand most of a small block.
+    if (n <= have && (size2class(n) == size2class(have) || n > have / 2))
+        return v;
+
+    if (!(nv = malloc(n)))
+        return 0;
+    memmove(nv, v, MIN(n, have));
+    free(v);
+    return nv;
+}
+
+// Use get() to find the calling thread's object cache, or turn the
+// caches off with get == 0.  Caches should be flushed with
+// malloc_cache_flush before they go away.
+    void
+malloc_set_cache(struct malloc_cache *(*get)(void))
+{
+    mcache_get = get;
 }
 
+// Return every object in mc to its slab.
+    void
+malloc_cache_flush(struct malloc_cache *mc)
+{
+    void *v;
+    int c;
+
+    for (c = 0; c < MCACHE_NCLASS; c++)
+        while (mc->mc_n[c] > 0) {
+            v = mc->mc_obj[c][--mc->mc_n[c]];
+            slab_free(v2slab(v), v);
+        }
+}
@@ -8,6 +8,15 @@
 #define REQVA		0x0ffff000
 union Nsipc nsipcbuf __attribute__((aligned(PGSIZE)));
 
+// Requests smaller than this are copied through nsipcbuf.  Larger
+// ones lend the caller's own buffer pages to the network server,
+// which hands them straight to lwIP (NSREQ_SENDV, NSREQ_RECVV).
+#define NSIPC_COPYMAX	1600
+// Most data one lending request can carry, for a page-aligned buffer.
+#define NSIPC_LENDMAX	((IPC_MAXPAGES - 1) * PGSIZE)
+
+static envid_t nsenv;
+
 // Send an IP request to the network server, and wait for a reply.
 // The request body should be in nsipcbuf, and parts of the response
 // may be written back to nsipcbuf.
@@ -16,7 +25,6 @@ union Nsipc nsipcbuf __attribute__((aligned(PGSIZE)));
     static int
 nsipc(unsigned type)
 {
-    static envid_t nsenv;
     //cprintf("In nsipc\n");
     if (nsenv == 0)
         nsenv = ipc_find_env(ENV_TYPE_NS);
@@ -27,9 +35,54 @@ nsipc(unsigned type)
     if (debug)
         cprintf("[%08x] nsipc %d\n", thisenv->env_id, type);
 
-    //cprintf("In nsipc doing ipc send\n");
-    ipc_send(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
-    //cprintf("In nsipc ipc send done\n");
+    return ipc_call(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U,
+                    NULL, NULL, NULL);
+}
+
+// Can the pages under [buf, buf+len) be lent with perm?
+    static bool
+nsipc_lendable(const void *buf, size_t len, int perm)
+{
+    uintptr_t va;
+    pte_t pte;
+
+    for (va = ROUNDDOWN((uintptr_t) buf, PGSIZE); va < (uintptr_t) buf + len; va += PGSIZE) {
+        if (!(vpml4e[VPML4E(va)] & PTE_P) || !(vpde[VPDPE(va)] & PTE_P)
+                || !(vpd[VPD(va)] & PTE_P))
+            return 0;
+        pte = (vpd[VPD(va)] & PTE_PS) ? vpd[VPD(va)] : vpt[VPN(va)];
+        if (!(pte & PTE_P) || !(pte & PTE_U) || ((perm & PTE_W) && !(pte & PTE_W)))
+            return 0;
+    }
+    return 1;
+}
+
+// Like nsipc, but also lend the network server the pages under
+// [buf, buf+len), which must be lendable with perm and span at most
+// IPC_MAXPAGES-1 pages.  They arrive right after the request page.
+    static int
+nsipc_lend(unsigned type, const void *buf, size_t len, int perm)
+{
+    struct Ipcv iv;
+    uintptr_t va;
+
+    if (nsenv == 0)
+        nsenv = ipc_find_env(ENV_TYPE_NS);
+
+    if (debug)
+        cprintf("[%08x] nsipc_lend %d %p+%d\n", thisenv->env_id, type, buf, len);
+
+    iv.iv_value = type;
+    iv.iv_perm = perm;
+    iv.iv_npages = 0;
+    iv.iv_len = 0;
+    iv.iv_pages[iv.iv_npages++] = &nsipcbuf;
+    for (va = ROUNDDOWN((uintptr_t) buf, PGSIZE); va < (uintptr_t) buf + len; va += PGSIZE) {
+        assert(iv.iv_npages < IPC_MAXPAGES);
+        iv.iv_pages[iv.iv_npages++] = (void *) va;
+    }
+
+    ipc_sendv(nsenv, &iv);
     return ipc_recv(NULL, NULL, NULL);
 }
 
@@ -91,8 +144,25 @@ nsipc_listen(int s, int backlog)
     int
 nsipc_recv(int s, void *mem, int len, unsigned int flags)
 {
+    uintptr_t off = (uintptr_t) mem % PGSIZE;
+    volatile char *p;
     int r;
 
+    if (len >= NSIPC_COPYMAX) {
+        // Fault in (and un-share) the pages lwIP will write to.
+        len = MIN(len, NSIPC_LENDMAX - off);
+        for (p = mem; p < (char *) mem + len; p = ROUNDDOWN(p + PGSIZE, PGSIZE))
+            *p = *p;
+        if (nsipc_lendable(mem, len, PTE_P|PTE_U|PTE_W)) {
+            nsipcbuf.recvv.req_s = s;
+            nsipcbuf.recvv.req_len = len;
+            nsipcbuf.recvv.req_flags = flags;
+            nsipcbuf.recvv.req_off = off;
+            return nsipc_lend(NSREQ_RECVV, mem, len, PTE_P|PTE_U|PTE_W);
+        }
+        len = NSIPC_COPYMAX - 1;
+    }
+
     nsipcbuf.recv.req_s = s;
     nsipcbuf.recv.req_len = len;
     nsipcbuf.recv.req_flags = flags;
@@ -105,8 +175,9 @@ nsipc_recv(int s, void *mem, int len, unsigned int flags)
     return r;
 }
 
-    int
-nsipc_send(int s, const void *buf, int size, unsigned int flags)
+// Send size bytes, size < NSIPC_COPYMAX, by copying them.
+    static int
+nsipc_send_copy(int s, const void *buf, int size, unsigned int flags)
 {
     nsipcbuf.send.req_s = s;
     assert(size < 1600);
@@ -116,6 +187,79 @@ nsipc_send(int s, const void *buf, int size, unsigned int flags)
     return nsipc(NSREQ_SEND);
 }
 
+    int
+nsipc_send(int s, const void *buf, int size, unsigned int flags)
+{
+    const char *p = buf;
+    int n, r, tot;
+
+    if (size < NSIPC_COPYMAX)
+        return nsipc_send_copy(s, buf, size, flags);
+
+    // Lend the buffer read-only, up to IPC_MAXPAGES-1 pages at a
+    // time.  Pieces we can't lend (say, pages that aren't mapped
+    // user-readable) are copied instead.
+    for (tot = 0; tot < size; tot += r) {
+        n = MIN(size - tot, NSIPC_LENDMAX - (uintptr_t) (p + tot) % PGSIZE);
+        if (nsipc_lendable(p + tot, n, PTE_P|PTE_U)) {
+            nsipcbuf.sendv.req_s = s;
+            nsipcbuf.sendv.req_size = n;
+            nsipcbuf.sendv.req_flags = flags;
+            nsipcbuf.sendv.req_off = (uintptr_t) (p + tot) % PGSIZE;
+            r = nsipc_lend(NSREQ_SENDV, p + tot, n, PTE_P|PTE_U);
+        } else {
+            n = MIN(n, NSIPC_COPYMAX - 1);
+            r = nsipc_send_copy(s, p + tot, n, flags);
+        }
+        if (r < 0)
+            return tot ? tot : r;
+        if (r < n)
+            return tot + r;
+    }
+    return tot;
+}
+
+// Send size bytes at buf, which must be lendable read-only and span
+// at most IPC_MAXPAGES-1 pages, and must not change until the peer
+// has acknowledged them (as with file pages from mmap): the network
+// server sends straight from the pages instead of copying them.
+// Returns the number of bytes taken, or < 0 on error.
+    int
+nsipc_sendfile(int s, const void *buf, int size, unsigned int flags)
+{
+    nsipcbuf.sendv.req_s = s;
+    nsipcbuf.sendv.req_size = size;
+    nsipcbuf.sendv.req_flags = flags;
+    nsipcbuf.sendv.req_off = (uintptr_t) buf % PGSIZE;
+    return nsipc_lend(NSREQ_SENDFILE, buf, size, PTE_P|PTE_U);
+}
+
+    int
+nsipc_poll(struct pollfd *fds, int nfds, int timeout)
+{
+    int r;
+
+    if (nfds < 0 || nfds > (int) NSPOLL_MAX)
+        return -E_INVAL;
+    nsipcbuf.poll.req_nfds = nfds;
+    nsipcbuf.poll.req_timeout = timeout;
+    memmove(nsipcbuf.poll.req_fds, fds, nfds * sizeof(struct pollfd));
+    if ((r = nsipc(NSREQ_POLL)) >= 0)
+        memmove(fds, nsipcbuf.poll.req_fds, nfds * sizeof(struct pollfd));
+    return r;
+}
+
+// Copy the network server's counters into st.
+    int
+nsipc_stats(struct Nsret_stats *st)
+{
+    int r;
+
+    if ((r = nsipc(NSREQ_STATS)) >= 0)
+        memmove(st, &nsipcbuf.statsRet, sizeof *st);
+    return r;
+}
+
     int
 nsipc_socket(int domain, int type, int protocol)
 {
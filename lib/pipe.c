@@ -17,20 +17,37 @@ struct Dev devpipe =
     .dev_stat =	devpipe_stat,
 };
 
-#define PIPEBUFSIZ 32		// small to provoke races
+// The pipe header lives in the first data page of both fds; the ring
+// buffer follows it in PIPEBUFPAGES more pages, all mapped PTE_SHARE.
+#define PIPEBUFPAGES	8
+#define PIPEBUFSIZ	(PIPEBUFPAGES * PGSIZE)
+
+// A blocked reader or writer rechecks for the other end having closed
+// at least this often (in ms), in case the close happened between its
+// check and its wait.
+#define PIPE_WAIT_MS	50
 
 struct Pipe {
-    off_t p_rpos;		// read position
-    off_t p_wpos;		// write position
-    uint8_t p_buf[PIPEBUFSIZ];	// data buffer
+    volatile uint32_t p_rpos;	// read position
+    volatile uint32_t p_wpos;	// write position
+    volatile uint32_t p_rwait;	// readers blocked waiting for p_wpos to move
+    volatile uint32_t p_wwait;	// writers blocked waiting for p_rpos to move
 };
 
+    static uint8_t *
+pipebuf(struct Pipe *p)
+{
+    return (uint8_t *) p + PGSIZE;
+}
+
     int
 pipe(int pfd[2])
 {
-    int r;
+    int i, r;
     struct Fd *fd0, *fd1;
-    void *va;
+    char *va;
+
+    static_assert(PIPEBUFPAGES + 1 <= FDDATAPAGES);
 
     // allocate the file descriptor table entries
     if ((r = fd_alloc(&fd0)) < 0
@@ -41,12 +58,15 @@ pipe(int pfd[2])
             || (r = sys_page_alloc(0, fd1, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
         goto err1;
 
-    // allocate the pipe structure as first data page in both
+    // allocate the pipe structure as first data page in both,
+    // followed by the buffer pages
     va = fd2data(fd0);
-    if ((r = sys_page_alloc(0, va, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
-        goto err2;
-    if ((r = sys_page_map(0, va, 0, fd2data(fd1), PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
-        goto err3;
+    for (i = 0; i < PIPEBUFPAGES + 1; i++) {
+        if ((r = sys_page_alloc(0, va + i*PGSIZE, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0
+                || (r = sys_page_map(0, va + i*PGSIZE, 0, fd2data(fd1) + i*PGSIZE,
+                                     PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+            goto err2;
+    }
 
     // set up fd structures
     fd0->fd_dev_id = devpipe.dev_id;
@@ -62,9 +82,11 @@ pipe(int pfd[2])
     pfd[1] = fd2num(fd1);
     return 0;
 
-err3:
-    sys_page_unmap(0, va);
 err2:
+    for (i = 0; i < PIPEBUFPAGES + 1; i++) {
+        sys_page_unmap(0, va + i*PGSIZE);
+        sys_page_unmap(0, fd2data(fd1) + i*PGSIZE);
+    }
     sys_page_unmap(0, fd1);
 err1:
     sys_page_unmap(0, fd0);
@@ -101,11 +123,33 @@ pipeisclosed(int fdnum)
     return _pipeisclosed(fd, p);
 }
 
+// Sleep until *pos moves away from seen.  We count ourselves in *nwait
+// first, so that the other end, which moves *pos before looking at
+// *nwait, either sees us or has already moved *pos (and then the
+// kernel won't put us to sleep).  May return early; callers recheck.
+    static void
+pipe_wait(volatile uint32_t *pos, volatile uint32_t *nwait, uint32_t seen)
+{
+    __sync_fetch_and_add(nwait, 1);
+    sys_futex_wait(pos, seen, PIPE_WAIT_MS);
+    __sync_fetch_and_sub(nwait, 1);
+}
+
+// *pos has just moved: wake whoever is waiting on it, if anyone.
+    static void
+pipe_wake(volatile uint32_t *pos, volatile uint32_t *nwait)
+{
+    __sync_synchronize();
+    if (*nwait)
+        sys_futex_wake(pos, ~0U);
+}
+
     static ssize_t
 devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 {
     uint8_t *buf;
-    size_t i;
+    size_t i, m, off;
+    uint32_t wpos;
     struct Pipe *p;
 
     p = (struct Pipe*)fd2data(fd);
@@ -114,8 +158,8 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
                 thisenv->env_id, vpt[PPN(p)], n, p->p_rpos, p->p_wpos);
 
     buf = vbuf;
-    for (i = 0; i < n; i++) {
-        while (p->p_rpos == p->p_wpos) {
+    for (i = 0; i < n; i += m) {
+        while ((wpos = p->p_wpos) == p->p_rpos) {
             // pipe is empty
             // if we got any data, return it
             if (i > 0)
@@ -123,15 +167,18 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
             // if all the writers are gone, note eof
             if (_pipeisclosed(fd, p))
                 return 0;
-            // yield and see what happens
+            // sleep until a writer moves wpos
             if (debug)
-                cprintf("devpipe_read yield\n");
-            sys_yield();
+                cprintf("devpipe_read wait\n");
+            pipe_wait(&p->p_wpos, &p->p_rwait, wpos);
         }
-        // there's a byte.  take it.
-        // wait to increment rpos until the byte is taken!
-        buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
-        p->p_rpos++;
+        // take as much as is there, up to the end of the ring.
+        // wait to advance rpos until the bytes are taken!
+        off = p->p_rpos % PIPEBUFSIZ;
+        m = MIN(MIN(n - i, wpos - p->p_rpos), PIPEBUFSIZ - off);
+        memcpy(buf + i, pipebuf(p) + off, m);
+        p->p_rpos += m;
+        pipe_wake(&p->p_rpos, &p->p_wwait);
     }
     return i;
 }
@@ -140,7 +187,8 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 {
     const uint8_t *buf;
-    size_t i;
+    size_t i, m, off;
+    uint32_t rpos;
     struct Pipe *p;
 
     p = (struct Pipe*) fd2data(fd);
@@ -149,23 +197,26 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
                 thisenv->env_id, vpt[PPN(p)], n, p->p_rpos, p->p_wpos);
 
     buf = vbuf;
-    for (i = 0; i < n; i++) {
-        while (p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
+    for (i = 0; i < n; i += m) {
+        while (p->p_wpos - (rpos = p->p_rpos) >= PIPEBUFSIZ) {
             // pipe is full
             // if all the readers are gone
             // (it's only writers like us now),
             // note eof
             if (_pipeisclosed(fd, p))
                 return 0;
-            // yield and see what happens
+            // sleep until a reader moves rpos
             if (debug)
-                cprintf("devpipe_write yield\n");
-            sys_yield();
+                cprintf("devpipe_write wait\n");
+            pipe_wait(&p->p_rpos, &p->p_wwait, rpos);
         }
-        // there's room for a byte.  store it.
-        // wait to increment wpos until the byte is stored!
-        p->p_buf[p->p_wpos % PIPEBUFSIZ] = buf[i];
-        p->p_wpos++;
+        // store as much as fits, up to the end of the ring.
+        // wait to advance wpos until the bytes are stored!
+        off = p->p_wpos % PIPEBUFSIZ;
+        m = MIN(MIN(n - i, PIPEBUFSIZ - (p->p_wpos - rpos)), PIPEBUFSIZ - off);
+        memcpy(pipebuf(p) + off, buf + i, m);
+        p->p_wpos += m;
+        pipe_wake(&p->p_wpos, &p->p_rwait);
     }
 
     return i;
@@ -182,10 +233,16 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
     return 0;
 }
 
+// Unmapping the header page last keeps pageref(fd) <= pageref(p) for
+// _pipeisclosed, and wakes any peer asleep in pipe_wait.
     static int
 devpipe_close(struct Fd *fd)
 {
+    char *va = fd2data(fd);
+    int i;
+
     (void) sys_page_unmap(0, fd);
-    return sys_page_unmap(0, fd2data(fd));
+    for (i = PIPEBUFPAGES; i > 0; i--)
+        (void) sys_page_unmap(0, va + i*PGSIZE);
+    return sys_page_unmap(0, va);
 }
-
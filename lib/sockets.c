@@ -103,6 +103,81 @@ listen(int s, int backlog)
     return nsipc_listen(r, backlog);
 }
 
+// Wait up to timeout msec (forever if timeout < 0) for one of the
+// events in each fds[i].events to happen on socket fds[i].fd, and set
+// fds[i].revents to what happened.  Entries with fd < 0 are ignored;
+// other non-sockets get POLLNVAL.  Returns the number of entries with
+// any revents, or < 0 on error.
+    int
+poll(struct pollfd *fds, int nfds, int timeout)
+{
+    struct pollfd *sfds;
+    int i, n, r;
+
+    if (nfds < 0 || nfds > (int) NSPOLL_MAX)
+        return -E_INVAL;
+    if (!(sfds = malloc(nfds * sizeof(struct pollfd))))
+        return -E_NO_MEM;
+
+    // Ask the NS about the sockets, by socket id.
+    n = 0;
+    for (i = 0; i < nfds; i++) {
+        fds[i].revents = 0;
+        sfds[i] = fds[i];
+        if (fds[i].fd < 0)
+            continue;
+        if ((sfds[i].fd = fd2sockid(fds[i].fd)) < 0) {
+            fds[i].revents = POLLNVAL;
+            n++;
+        }
+    }
+
+    if ((r = nsipc_poll(sfds, nfds, n ? 0 : timeout)) >= 0) {
+        for (i = 0; i < nfds; i++)
+            if (sfds[i].fd >= 0)
+                fds[i].revents = sfds[i].revents;
+        r += n;
+    }
+    free(sfds);
+    return r;
+}
+
+// Where sendfile maps the file pages it lends to the network server.
+#define SENDFILEVA	0xE0100000
+
+// Send len bytes of the open file fdnum, starting at offset, on socket
+// s.  The file server's block-cache pages are mapped here with mmap
+// and lent to the network server, which sends from them directly, so
+// the data is never copied on the way.  Returns the number of bytes
+// sent, which is less than len if the file ends first, or < 0 on error.
+    ssize_t
+sendfile(int s, int fdnum, off_t offset, size_t len)
+{
+    size_t done, pgoff, n;
+    int sockid, r;
+
+    if ((sockid = fd2sockid(s)) < 0)
+        return sockid;
+
+    r = 0;
+    for (done = 0; done < len; done += r) {
+        pgoff = (offset + done) % PGSIZE;
+        n = MIN(len - done, (IPC_MAXPAGES - 1) * PGSIZE - pgoff);
+        if ((r = mmap((void *) SENDFILEVA, pgoff + n, fdnum,
+                        offset + done - pgoff)) < 0)
+            break;
+        if (r <= (int) pgoff)
+            break;
+        n = MIN(n, r - pgoff);
+        if ((r = nsipc_sendfile(sockid, (char *) SENDFILEVA + pgoff, n, 0)) <= 0)
+            break;
+    }
+    munmap((void *) SENDFILEVA, (IPC_MAXPAGES - 1) * PGSIZE);
+    if (r < 0 && done == 0)
+        return r;
+    return done;
+}
+
     static ssize_t
 devsock_read(struct Fd *fd, void *buf, size_t n)
 {
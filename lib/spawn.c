@@ -9,6 +9,8 @@
 static int init_stack(envid_t child, const char **argv, uintptr_t *init_esp);
 static int map_segment(envid_t child, uintptr_t va, size_t memsz,
         int fd, size_t filesz, off_t fileoffset, int perm);
+static int map_cached(envid_t child, uintptr_t va, size_t len,
+        int fd, off_t fileoffset, int perm);
 static int copy_shared_pages(envid_t child);
 
 // Spawn a child process from a program image loaded from the file system.
@@ -264,7 +266,7 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
         int fd, size_t filesz, off_t fileoffset, int perm)
 {
     int i, r;
-    void *blk;
+    size_t ncached;
 
     //cprintf("map_segment %x+%x\n", va, memsz);
 
@@ -275,7 +277,16 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
         fileoffset -= i;
     }
 
-    for (i = 0; i < memsz; i += PGSIZE) {
+    // Leading pages that hold only file data are mapped straight from
+    // the file server's block cache: read-only text is shared, and data
+    // is copy-on-write, so it is only copied when the child first writes
+    // it.  If the file can't be mapped, copy the whole segment instead.
+    for (ncached = 0; ncached < memsz && MIN(ncached + PGSIZE, memsz) <= filesz; )
+        ncached += PGSIZE;
+    if (ncached && map_cached(child, va, ncached, fd, fileoffset, perm) < 0)
+        ncached = 0;
+
+    for (i = ncached; i < memsz; i += PGSIZE) {
         if (i >= filesz) {
             // allocate a blank page
             if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
@@ -296,12 +307,52 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
     return 0;
 }
 
+// Map len bytes of fd at the page-aligned fileoffset into child at va
+// using the file server's cache pages, IPC_MAXPAGES pages at a time
+// through a window at UTEMP.  Writable segments are mapped PTE_COW.
+    static int
+map_cached(envid_t child, uintptr_t va, size_t len,
+        int fd, off_t fileoffset, int perm)
+{
+    size_t i, j, n;
+    int r;
+
+    if (perm & PTE_W)
+        perm = (perm & ~PTE_W) | PTE_COW;
+    for (i = 0; i < len; i += n) {
+        n = MIN(len - i, IPC_MAXPAGES * PGSIZE);
+        if ((r = mmap(UTEMP, n, fd, fileoffset + i)) < 0)
+            return r;
+        if (r < n) {
+            // the file is shorter than the program header says
+            munmap(UTEMP, n);
+            return -E_NOT_EXEC;
+        }
+        for (j = 0; j < n; j += PGSIZE)
+            if ((r = sys_page_map(0, UTEMP + j, child, (void*) (va + i + j), perm)) < 0) {
+                munmap(UTEMP, n);
+                return r;
+            }
+        munmap(UTEMP, n);
+    }
+    return 0;
+}
+
 // Copy the mappings for shared pages into the child address space.
     static int
 copy_shared_pages(envid_t child)
 {
         uint64_t addr;
 	for (addr = UTEXT; addr < USTACKTOP-PGSIZE; addr += PGSIZE) {
+               if((vpml4e[VPML4E(addr)] & PTE_P) && (vpde[VPDPE(addr)] & PTE_P)
+                 && (vpd[VPD(addr)] & PTE_PS)) {
+                        // A superpage has no page table for vpt to show.
+                        int perm_share = vpd[VPD(addr)] & PTE_USER;
+                        if ((perm_share & PTE_SHARE) && addr % PTSIZE == 0)
+                                sys_page_map(0, (void *)addr, child, (void *)addr, perm_share | PTE_PS);
+                        addr = ROUNDUP(addr + 1, PTSIZE) - PGSIZE;
+                        continue;
+               }
                if((vpml4e[VPML4E(addr)] & PTE_P) && (vpde[VPDPE(addr)] & PTE_P)  
                  && (vpd[VPD(addr)] & PTE_P) && (vpt[VPN(addr)] & PTE_P)) {
                         int perm_share = vpt[VPN(addr)] & PTE_USER;
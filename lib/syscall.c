@@ -117,6 +117,60 @@ sys_ipc_recv(void *dstva)
     return syscall(SYS_ipc_recv, 1, (uint64_t)dstva, 0, 0, 0, 0);
 }
 
+    int
+sys_ipc_send(envid_t envid, uint64_t value, void *srcva, int perm, unsigned timeout)
+{
+    return syscall(SYS_ipc_send, 0, envid, value, (uint64_t) srcva, perm, timeout);
+}
+
+    int
+sys_ipc_sendv(envid_t envid, const struct Ipcv *iv, unsigned timeout)
+{
+    return syscall(SYS_ipc_sendv, 0, envid, (uint64_t) iv, timeout, 0, 0);
+}
+
+    int
+sys_ipc_recvv(void *dstva, unsigned npages)
+{
+    return syscall(SYS_ipc_recvv, 1, (uint64_t) dstva, npages, 0, 0, 0);
+}
+
+    int
+sys_ipc_alarm(unsigned deadline, uint32_t value)
+{
+    return syscall(SYS_ipc_alarm, 0, deadline, value, 0, 0, 0);
+}
+
+    int
+sys_futex_wait(volatile uint32_t *uaddr, uint32_t val, unsigned timeout)
+{
+    return syscall(SYS_futex_wait, 0, (uint64_t) uaddr, val, timeout, 0, 0);
+}
+
+    int
+sys_futex_wake(volatile uint32_t *uaddr, unsigned n)
+{
+    return syscall(SYS_futex_wake, 0, (uint64_t) uaddr, n, 0, 0, 0);
+}
+
+    envid_t
+sys_fork_cow(void)
+{
+    return syscall(SYS_fork_cow, 0, 0, 0, 0, 0, 0);
+}
+
+    int
+sys_page_prezero(int n)
+{
+    return syscall(SYS_page_prezero, 0, n, 0, 0, 0, 0);
+}
+
+    int
+sys_ipc_call(envid_t envid, uint64_t value, void *srcva, int perm, void *dstva)
+{
+    return syscall(SYS_ipc_call, 0, envid, value, (uint64_t) srcva, perm, (uint64_t) dstva);
+}
+
     unsigned int
 sys_time_msec(void)
 {
@@ -147,3 +201,15 @@ sys_env_receive_packet(envid_t envid, char *data, size_t *len)
 {
 	return syscall(SYS_env_receive_packet, 1, envid, (uint64_t)data, (uint64_t)len, 0, 0);
 }
+
+	int
+sys_ide_dma_attach(void)
+{
+	return syscall(SYS_ide_dma_attach, 0, 0, 0, 0, 0, 0);
+}
+
+	int
+sys_ide_wait_intr(void)
+{
+	return syscall(SYS_ide_wait_intr, 0, 0, 0, 0, 0, 0);
+}
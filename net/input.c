@@ -1,8 +1,5 @@
 #include "ns.h"
 
-extern union Nsipc nsipcbuf;
-static struct jif_pkt *pkt = (struct jif_pkt*)&nsipcbuf;
-
 	void
 static msleep(int msec)
 {
@@ -18,20 +15,30 @@ static msleep(int msec)
 		sys_yield();
 }
 
+// Move frames from the driver to the input ring, as many as it has
+// room for, telling the network server only when it asked to be told.
     void
 input(envid_t ns_envid)
 {
     binaryname = "ns_input";
 
-	int r;
-	if ((r = sys_page_alloc(0, pkt, PTE_P|PTE_U|PTE_W)) < 0)
-		panic("sys_page_map: %e", r);
+	struct Pktring *ring = INRINGVA;
+	struct jif_pkt *pkt;
+	size_t len;
+	int n;
 
 	while(1) {
-		while( (r = sys_env_receive_packet(0, (char*)(pkt->jp_data), (size_t*)(&pkt->jp_len)) < 0) ) {
-			msleep(10);
+		for (n = 0; (pkt = pktring_free_slot(ring)); n++) {
+			len = PKTRING_MAXLEN;
+			if (sys_env_receive_packet(0, pkt->jp_data, &len) < 0)
+				break;
+			pkt->jp_len = len;
+			if (pktring_produce(ring))
+				ipc_send(ns_envid, NSREQ_INPUT, 0, 0);
 		}
-		ipc_send(ns_envid, NSREQ_INPUT, pkt, PTE_P|PTE_W|PTE_U);
-		msleep(10);
+		// Wait for the driver, or for the network server to drain
+		// the ring.
+		if (n == 0)
+			msleep(pkt ? 10 : 1);
 	}
 }
@@ -164,6 +164,7 @@ static const int err_to_errno_table[] = {
 static void event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len);
 static void lwip_getsockopt_internal(void *arg);
 static void lwip_setsockopt_internal(void *arg);
+static int lwip_send_write(int s, const void *data, int size, unsigned int flags, u8_t copy);
 
 /**
  * Initialize this module. This function has to be called before any other
@@ -607,6 +608,23 @@ lwip_recv(int s, void *mem, int len, unsigned int flags)
 
 int
 lwip_send(int s, const void *data, int size, unsigned int flags)
+{
+  return lwip_send_write(s, data, size, flags, NETCONN_COPY);
+}
+
+/**
+ * Like lwip_send, but TCP data is not copied: the segments reference it
+ * (as PBUF_REF) until the remote party ACKs it, so the caller must leave
+ * it in place until no segment of the connection points into it.
+ */
+int
+lwip_send_nocopy(int s, const void *data, int size, unsigned int flags)
+{
+  return lwip_send_write(s, data, size, flags, NETCONN_NOCOPY);
+}
+
+static int
+lwip_send_write(int s, const void *data, int size, unsigned int flags, u8_t copy)
 {
   struct lwip_socket *sock;
   err_t err;
@@ -627,7 +645,7 @@ lwip_send(int s, const void *data, int size, unsigned int flags)
 #endif /* (LWIP_UDP || LWIP_RAW) */
   }
 
-  err = netconn_write(sock->conn, data, size, NETCONN_COPY | ((flags & MSG_MORE)?NETCONN_MORE:0));
+  err = netconn_write(sock->conn, data, size, copy | ((flags & MSG_MORE)?NETCONN_MORE:0));
 
   LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d) err=%d size=%d\n", s, err, size));
   sock_set_errno(sock, err_to_errno(err));
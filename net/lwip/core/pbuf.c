@@ -250,6 +250,38 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
 }
 
 
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/**
+ * Initialize a custom pbuf, whose struct and payload memory belong to
+ * the caller. It is handed back through p->custom_free_function, which
+ * the caller must have set, once its last reference is freed.
+ *
+ * @param type PBUF_REF or PBUF_ROM
+ * @param p the custom pbuf to initialize
+ * @param payload_mem where the payload starts
+ * @param length the payload's length in bytes
+ * @return the initialized pbuf
+ */
+struct pbuf *
+pbuf_alloced_custom(pbuf_type type, struct pbuf_custom *p,
+                    void *payload_mem, u16_t length)
+{
+  LWIP_ASSERT("pbuf_alloced_custom: bad pbuf type",
+              type == PBUF_REF || type == PBUF_ROM);
+  LWIP_ASSERT("pbuf_alloced_custom: no free function",
+              p->custom_free_function != NULL);
+  p->pbuf.next = NULL;
+  p->pbuf.payload = payload_mem;
+  p->pbuf.tot_len = length;
+  p->pbuf.len = length;
+  p->pbuf.type = type;
+  p->pbuf.flags = PBUF_FLAG_IS_CUSTOM;
+  p->pbuf.ref = 1;
+  p->payload_mem = payload_mem;
+  return &p->pbuf;
+}
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
 /**
  * Shrink a pbuf chain to a desired length.
  *
@@ -399,6 +431,13 @@ pbuf_header(struct pbuf *p, s16_t header_size_increment)
     if ((header_size_increment < 0) && (increment_magnitude <= p->len)) {
       /* increase payload pointer */
       p->payload = (u8_t *)p->payload - header_size_increment;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+    /* uncover a header hidden earlier in a custom pbuf's memory? */
+    } else if ((p->flags & PBUF_FLAG_IS_CUSTOM) &&
+               (u8_t *)p->payload - header_size_increment >=
+               (u8_t *)((struct pbuf_custom *)p)->payload_mem) {
+      p->payload = (u8_t *)p->payload - header_size_increment;
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
     } else {
       /* cannot expand payload to front (yet!)
        * bail out unsuccesfully */
@@ -495,6 +534,12 @@ pbuf_free(struct pbuf *p)
       q = p->next;
       LWIP_DEBUGF( PBUF_DEBUG | 2, ("pbuf_free: deallocating %p\n", (void *)p));
       type = p->type;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+      /* is this a custom pbuf? its creator frees it */
+      if (p->flags & PBUF_FLAG_IS_CUSTOM) {
+        ((struct pbuf_custom *)p)->custom_free_function(p);
+      } else
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
       /* is this a pbuf from the pool? */
       if (type == PBUF_POOL) {
         memp_free(MEMP_PBUF_POOL, p);
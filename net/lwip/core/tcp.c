@@ -73,9 +73,69 @@ struct tcp_pcb *tcp_tw_pcbs;
 
 struct tcp_pcb *tcp_tmp_pcb;
 
+/** Hash table of active and TIME-WAIT PCBs (see tcp.h) */
+struct tcp_pcb *tcp_conn_hash[TCP_CONN_HASH_SIZE];
+/** Hash table of LISTEN PCBs, by port */
+struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+
 static u8_t tcp_timer;
 static u16_t tcp_new_port(void);
 
+/**
+ * Find the hash bucket for a PCB on one of the lists.
+ *
+ * @param pcbs the list the PCB is on
+ * @param pcb the PCB
+ * @return the bucket, or NULL if PCBs on this list aren't hashed
+ */
+static struct tcp_pcb **
+tcp_pcb_bucket(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if (pcbs == &tcp_active_pcbs || pcbs == &tcp_tw_pcbs) {
+    return &tcp_conn_hash[TCP_CONN_HASH(pcb->local_port, pcb->remote_port, &(pcb->remote_ip))];
+  }
+  if (pcbs == &tcp_listen_pcbs.pcbs) {
+    return (struct tcp_pcb **)&tcp_listen_hash[TCP_LISTEN_HASH(pcb->local_port)];
+  }
+  return NULL;
+}
+
+/**
+ * Enter a PCB that has just been put on a list into that list's hash
+ * table. Called from TCP_REG.
+ */
+void
+tcp_pcb_hash_add(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **bucket = tcp_pcb_bucket(pcbs, pcb);
+
+  if (bucket != NULL) {
+    pcb->hash_next = *bucket;
+    *bucket = pcb;
+  }
+}
+
+/**
+ * Remove a PCB that has just been taken off a list from that list's
+ * hash table. Called from TCP_RMV.
+ */
+void
+tcp_pcb_hash_del(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **pp = tcp_pcb_bucket(pcbs, pcb);
+
+  if (pp == NULL) {
+    return;
+  }
+  for (; *pp != NULL; pp = &(*pp)->hash_next) {
+    if (*pp == pcb) {
+      *pp = pcb->hash_next;
+      break;
+    }
+  }
+  pcb->hash_next = NULL;
+}
+
 /**
  * Called periodically to dispatch TCP timers.
  *
@@ -709,6 +769,7 @@ tcp_slowtmr(void)
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
         tcp_active_pcbs = pcb->next;
       }
+      tcp_pcb_hash_del(&tcp_active_pcbs, pcb);
 
       TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_ABRT);
 
@@ -760,6 +821,7 @@ tcp_slowtmr(void)
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
         tcp_tw_pcbs = pcb->next;
       }
+      tcp_pcb_hash_del(&tcp_tw_pcbs, pcb);
       pcb2 = pcb->next;
       memp_free(MEMP_TCP_PCB, pcb);
       pcb = pcb2;
@@ -241,11 +241,12 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     /* do not copy data */
     else {
       /* First, allocate a pbuf for holding the data.
-       * since the referenced data is available at least until it is sent out on the
-       * link (as it has to be ACKed by the remote party) we can safely use PBUF_ROM
-       * instead of PBUF_REF here.
+       * The referenced data only has to stay put until the remote party
+       * ACKs it, so use PBUF_REF rather than PBUF_ROM: anything that
+       * holds on to the packet beyond the segment queues (such as the
+       * ARP queue) then takes a copy of it.
        */
-      if ((p = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM)) == NULL) {
+      if ((p = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_REF)) == NULL) {
         LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 2, ("tcp_enqueue: could not allocate memory for zero-copy pbuf\n"));
         goto memerr;
       }
@@ -757,6 +758,7 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
   pcb->rttest = 0;
 
   /* Do the actual retransmission */
+  TCP_STATS_INC(tcp.rexmit);
   tcp_output(pcb);
 }
 
@@ -791,6 +793,7 @@ tcp_rexmit(struct tcp_pcb *pcb)
 
   /* Do the actual retransmission. */
   snmp_inc_tcpretranssegs();
+  TCP_STATS_INC(tcp.rexmit);
   tcp_output(pcb);
 }
 
@@ -224,6 +224,23 @@
 #define MEMP_NUM_TCP_PCB_LISTEN         8
 #endif
 
+/**
+ * TCP_CONN_HASH_SIZE: the number of buckets in the hash table of active
+ * and TIME-WAIT TCP PCBs that tcp_input uses to find a segment's
+ * connection. Must be a power of 2.
+ */
+#ifndef TCP_CONN_HASH_SIZE
+#define TCP_CONN_HASH_SIZE              16
+#endif
+
+/**
+ * TCP_LISTEN_HASH_SIZE: the number of buckets in the hash table of
+ * listening TCP PCBs, indexed by port. Must be a power of 2.
+ */
+#ifndef TCP_LISTEN_HASH_SIZE
+#define TCP_LISTEN_HASH_SIZE            8
+#endif
+
 /**
  * MEMP_NUM_TCP_SEG: the number of simultaneously queued TCP segments.
  * (requires the LWIP_TCP option)
@@ -789,6 +806,15 @@
 #define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_MSS+40+PBUF_LINK_HLEN)
 #endif
 
+/**
+ * LWIP_SUPPORT_CUSTOM_PBUF==1: Support pbufs whose memory belongs to the
+ * netif driver (struct pbuf_custom), which are handed back to the driver
+ * when freed.
+ */
+#ifndef LWIP_SUPPORT_CUSTOM_PBUF
+#define LWIP_SUPPORT_CUSTOM_PBUF        0
+#endif
+
 /*
    ------------------------------------------------
    ---------- Network Interfaces options ----------
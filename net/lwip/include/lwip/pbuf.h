@@ -60,6 +60,8 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** indicates the netif has already verified this packet's TCP/UDP checksum */
+#define PBUF_FLAG_CSUM_OK 0x02U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -95,6 +97,28 @@ struct pbuf {
   
 };
 
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/** indicates this pbuf is a struct pbuf_custom */
+#define PBUF_FLAG_IS_CUSTOM 0x04U
+
+/** Called instead of freeing a custom pbuf's memory when it is freed */
+typedef void (*pbuf_free_custom_fn)(struct pbuf *p);
+
+/** A PBUF_REF or PBUF_ROM pbuf whose memory is looked after by its creator */
+struct pbuf_custom {
+  /** the pbuf proper, which must come first */
+  struct pbuf pbuf;
+  /** where the payload memory starts; headers hidden with pbuf_header()
+      may be uncovered again back to here */
+  void *payload_mem;
+  /** called when the pbuf's last reference goes away */
+  pbuf_free_custom_fn custom_free_function;
+};
+
+struct pbuf *pbuf_alloced_custom(pbuf_type type, struct pbuf_custom *p,
+                                 void *payload_mem, u16_t length);
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
 /* Initializes the pbuf module. This call is empty for now, but may not be in future. */
 #define pbuf_init()
 
@@ -263,6 +263,7 @@ enum tcp_state {
  */
 #define TCP_PCB_COMMON(type) \
   type *next; /* for the linked list */ \
+  type *hash_next; /* for the hash table over the list */ \
   enum tcp_state state; /* TCP state */ \
   u8_t prio; \
   void *callback_arg; \
@@ -573,6 +574,23 @@ extern struct tcp_pcb *tcp_tw_pcbs;      /* List of all TCP PCBs in TIME-WAIT. *
 
 extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 
+/* Hash tables over the lists, for tcp_input to find the PCB for a
+   segment. Active and TIME-WAIT PCBs share one table, keyed on the
+   ports and the remote address: the local address can still change
+   while a PCB is on a list (tcp_output fills it in). Listening PCBs
+   are keyed on their port. TCP_REG and TCP_RMV keep the tables in
+   step with the lists. */
+extern struct tcp_pcb *tcp_conn_hash[TCP_CONN_HASH_SIZE];
+extern struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+
+#define TCP_CONN_HASH(lport, rport, rip) \
+  (((((u32_t)(lport) << 16 | (rport)) ^ (rip)->addr) * 2654435761U >> 16) & \
+   (TCP_CONN_HASH_SIZE - 1))
+#define TCP_LISTEN_HASH(lport) ((lport) & (TCP_LISTEN_HASH_SIZE - 1))
+
+void tcp_pcb_hash_add(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+void tcp_pcb_hash_del(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+
 /* Axioms about the above lists:   
    1) Every TCP PCB that is not CLOSED is in one of the lists.
    2) A PCB is only in one of the lists.
@@ -594,6 +612,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                             npcb->next = *pcbs; \
                             LWIP_ASSERT("TCP_REG: npcb->next != npcb", npcb->next != npcb); \
                             *(pcbs) = npcb; \
+                            tcp_pcb_hash_add((struct tcp_pcb **)(pcbs), (struct tcp_pcb *)(npcb)); \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
               tcp_timer_needed(); \
                             } while(0)
@@ -609,6 +628,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                                } \
                             } \
                             npcb->next = NULL; \
+                            tcp_pcb_hash_del((struct tcp_pcb **)(pcbs), (struct tcp_pcb *)(npcb)); \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removed %p from %p\n", npcb, *pcbs)); \
                             } while(0)
@@ -617,6 +637,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 #define TCP_REG(pcbs, npcb) do { \
                             npcb->next = *pcbs; \
                             *(pcbs) = npcb; \
+                            tcp_pcb_hash_add((struct tcp_pcb **)(pcbs), (struct tcp_pcb *)(npcb)); \
               tcp_timer_needed(); \
                             } while(0)
 #define TCP_RMV(pcbs, npcb) do { \
@@ -629,6 +650,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                                } \
                             } \
                             npcb->next = NULL; \
+                            tcp_pcb_hash_del((struct tcp_pcb **)(pcbs), (struct tcp_pcb *)(npcb)); \
                             } while(0)
 #endif /* LWIP_DEBUG */
 
@@ -34,6 +34,11 @@ typedef uintptr_t mem_ptr_t;
 #define LWIP_PLATFORM_DIAG(x)	cprintf x
 #define LWIP_PLATFORM_ASSERT(x)	panic(x)
 
+// x86-64 Internet checksum (chksum.S)
+u16_t jos_chksum(void *dataptr, u16_t len);
+u16_t jos_chksum_copy(void *dst, const void *src, u16_t len);
+#define LWIP_CHKSUM		jos_chksum
+
 #ifndef BYTE_ORDER
 #define BYTE_ORDER LITTLE_ENDIAN
 #endif
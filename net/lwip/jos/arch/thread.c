@@ -10,10 +10,16 @@ static struct thread_context *cur_tc;
 static struct thread_queue thread_queue;
 static struct thread_queue kill_queue;
 
+static struct malloc_cache *
+thread_mcache(void) {
+    return cur_tc ? &cur_tc->tc_mcache : 0;
+}
+
 void
 thread_init(void) {
     threadq_init(&thread_queue);
     max_tid = 0;
+    malloc_set_cache(thread_mcache);
 }
 
 uint32_t
@@ -38,6 +44,7 @@ thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
 
     cur_tc->tc_wait_addr = addr;
     cur_tc->tc_wakeup = 0;
+    cur_tc->tc_wait_msec = msec == (uint32_t) ~0 ? 0 : msec;
 
     while (p < msec) {
 	if (p < s)
@@ -53,6 +60,7 @@ thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
 
     cur_tc->tc_wait_addr = 0;
     cur_tc->tc_wakeup = 0;
+    cur_tc->tc_wait_msec = 0;
 }
 
 int
@@ -68,6 +76,21 @@ thread_wakeups_pending(void)
     return n;
 }
 
+// The earliest sys_time_msec() at which some other thread's
+// thread_wait times out, or 0 if none of them has a deadline.
+uint32_t
+thread_next_deadline(void)
+{
+    struct thread_context *tc = thread_queue.tq_first;
+    uint32_t next = 0;
+    while (tc) {
+	if (tc->tc_wait_msec && (!next || tc->tc_wait_msec < next))
+	    next = tc->tc_wait_msec;
+	tc = tc->tc_queue_link;
+    }
+    return next;
+}
+
 int
 thread_onhalt(void (*fun)(thread_id_t)) {
     if (cur_tc->tc_nonhalt >= THREAD_NUM_ONHALT)
@@ -141,6 +164,7 @@ thread_clean(struct thread_context *tc) {
     int i;
     for (i = 0; i < tc->tc_nonhalt; i++)
 	tc->tc_onhalt[i](tc->tc_tid);
+    malloc_cache_flush(&tc->tc_mcache);
     free(tc->tc_stack_bottom);
     free(tc);
 }
@@ -25,8 +25,10 @@ struct thread_context {
     struct jos_jmp_buf	tc_jb;
     volatile uint32_t	*tc_wait_addr;
     volatile char	tc_wakeup;
+    uint32_t		tc_wait_msec;	// thread_wait deadline, 0 if none
     void		(*tc_onhalt[THREAD_NUM_ONHALT])(thread_id_t);
     int			tc_nonhalt;
+    struct malloc_cache	tc_mcache;
     struct thread_context *tc_queue_link;
 };
 
@@ -40,12 +40,12 @@
 #include "lwip/mem.h"
 #include "lwip/pbuf.h"
 #include "lwip/sys.h"
+#include "lwip/ip.h"
+#include "lwip/tcp.h"
 #include <lwip/stats.h>
 
 #include <netif/etharp.h>
 
-#define PKTMAP		0x10000000
-
 struct jif {
     struct eth_addr *ethaddr;
     envid_t envid;
@@ -69,6 +69,65 @@ low_level_init(struct netif *netif)
     netif->hwaddr[5] = 0x56;
 }
 
+/*
+ * Checksums are summed while frames are copied to and from the
+ * packet rings (jos_chksum_copy), which leaves only the headers to
+ * take back out.  Copies are summed in pieces; a piece that starts
+ * at an odd offset into the frame has its sum byte-swapped.
+ */
+static u32_t
+chksum_add(u32_t sum, u16_t piece, int off)
+{
+    if (off & 1)
+	piece = (piece << 8) | (piece >> 8);
+    return sum + piece;
+}
+
+static u16_t
+chksum_fold(u32_t sum)
+{
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return sum;
+}
+
+/*
+ * frame_l4_sum():
+ *
+ * Given the sum of a whole Ethernet frame, return the TCP or UDP
+ * checksum sum of the IP datagram it carries, pseudo-header included,
+ * and its protocol in *proto.  Returns -1 unless the frame holds
+ * exactly one unfragmented IPv4 TCP or UDP datagram.
+ */
+static int
+frame_l4_sum(u8_t *frame, int len, u32_t sum, u8_t *proto)
+{
+    struct eth_hdr *ethhdr = (struct eth_hdr *) frame;
+    struct ip_hdr *iphdr = (struct ip_hdr *) (frame + sizeof(struct eth_hdr));
+    int hlen, iplen;
+
+    if (len < (int) sizeof(struct eth_hdr) + IP_HLEN
+	|| ethhdr->type != htons(ETHTYPE_IP) || IPH_V(iphdr) != 4)
+	return -1;
+    hlen = IPH_HL(iphdr) * 4;
+    iplen = ntohs(IPH_LEN(iphdr));
+    if (hlen < IP_HLEN || iplen < hlen
+	|| (int) sizeof(struct eth_hdr) + iplen != len
+	|| (IPH_OFFSET(iphdr) & htons(IP_OFFMASK | IP_MF)))
+	return -1;
+    *proto = IPH_PROTO(iphdr);
+    if (*proto != IP_PROTO_TCP && *proto != IP_PROTO_UDP)
+	return -1;
+
+    // Both headers are an even number of bytes, so the datagram's
+    // payload sums from an even offset.
+    sum += (u16_t) ~jos_chksum(frame, sizeof(struct eth_hdr) + hlen);
+    sum += (iphdr->src.addr & 0xffff) + (iphdr->src.addr >> 16);
+    sum += (iphdr->dest.addr & 0xffff) + (iphdr->dest.addr >> 16);
+    sum += htons(*proto) + htons(iplen - hlen);
+    return chksum_fold(sum);
+}
+
 /*
  * low_level_output():
  *
@@ -80,58 +139,164 @@ low_level_init(struct netif *netif)
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
-    if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
+    struct Pktring *ring = OUTRINGVA;
+    struct jif_pkt *pkt;
 
-    struct jif *jif;
-    jif = netif->state;
+    // Ring full: let the output helper catch up.
+    while (!(pkt = pktring_free_slot(ring)))
+	sys_yield();
 
     char *txbuf = pkt->jp_data;
     int txsize = 0;
+    u32_t sum = 0;
     struct pbuf *q;
+    struct ip_hdr *iphdr;
+    struct tcp_hdr *tcphdr;
+    int l4sum;
+    u8_t proto;
     for (q = p; q != NULL; q = q->next) {
 	/* Send the data from the pbuf to the interface, one pbuf at a
 	   time. The size of the data in each pbuf is kept in the ->len
 	   variable. */
 
-	if (txsize + q->len > 2000)
+	if (txsize + q->len > PKTRING_MAXLEN)
 	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
-	memcpy(&txbuf[txsize], q->payload, q->len);
+	sum = chksum_add(sum, jos_chksum_copy(&txbuf[txsize], q->payload, q->len),
+			 txsize);
 	txsize += q->len;
     }
 
+    // lwIP leaves TCP checksums zero for us (CHECKSUM_GEN_TCP).
+    l4sum = frame_l4_sum((u8_t *) txbuf, txsize, sum, &proto);
+    if (l4sum >= 0 && proto == IP_PROTO_TCP) {
+	iphdr = (struct ip_hdr *) (txbuf + sizeof(struct eth_hdr));
+	tcphdr = (struct tcp_hdr *) ((u8_t *) iphdr + IPH_HL(iphdr) * 4);
+	tcphdr->chksum = ~l4sum;
+    }
+
     pkt->jp_len = txsize;
 
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+    if (pktring_produce(ring))
+	sys_futex_wake(&ring->pr_tail, 1);
 
     return ERR_OK;
 }
 
 /*
- * low_level_input():
- *
- * Should allocate a pbuf and transfer the bytes of the incoming
- * packet from the interface into the pbuf.
+ * Received frames are lent to lwIP where they lie: low_level_input
+ * wraps each input ring slot in a custom PBUF_REF pbuf, and the slot
+ * goes back to the input helper when lwIP frees the pbuf.  Slots go
+ * back in ring order, so a frame lwIP keeps a while (data waiting in
+ * a socket, or a segment queued out of order) holds back the ones
+ * after it.  Once more than RX_MAXLENT slots are out, the oldest
+ * frame is moved to the heap and its slot released.  lwIP keeps
+ * pointers into a frame beyond its pbuf's payload only in queued
+ * out-of-order TCP segments, so those are moved along with it.
+ */
+#define RX_MAXLENT	(PKTRING_NSLOT / 2)
+
+struct rxbuf {
+    struct pbuf_custom rb_pc;
+    struct jif_pkt *rb_pkt;	// ring slot holding the frame, or 0
+    void *rb_copy;		// heap copy, once moved off the ring
+};
+
+// The rxbuf each taken input ring slot is lent out in.
+static struct rxbuf *rxlent[PKTRING_NSLOT];
+
+static int
+rxslot(struct jif_pkt *pkt)
+{
+    return ((char *) pkt - (char *) INRINGVA - PGSIZE) / PKTRING_SLOTSZ;
+}
+
+static void
+rxbuf_free(struct pbuf *p)
+{
+    struct rxbuf *rb = (struct rxbuf *) p;
+
+    if (rb->rb_pkt) {
+	rxlent[rxslot(rb->rb_pkt)] = 0;
+	pktring_release(INRINGVA, rb->rb_pkt);
+    } else
+	mem_free(rb->rb_copy);
+    mem_free(rb);
+}
+
+// If *pp points into the len bytes at from, point it at the same
+// byte in to.
+static void
+rxbuf_rebase(void **pp, u8_t *from, u8_t *to, u16_t len)
+{
+    u8_t *p = *pp;
+
+    if (p >= from && p < from + len)
+	*pp = to + (p - from);
+}
+
+// Move the oldest lent frame off the ring and release its slot.
+// Returns -1 if there is no memory to move it to.
+static int
+rxbuf_unlend(void)
+{
+    struct Pktring *ring = INRINGVA;
+    struct jif_pkt *pkt = pktring_slot(ring, ring->pr_head);
+    struct rxbuf *rb = rxlent[rxslot(pkt)];
+    u8_t *copy;
+#if TCP_QUEUE_OOSEQ
+    struct tcp_pcb *pcbs[2] = { tcp_active_pcbs, tcp_tw_pcbs };
+    struct tcp_pcb *pcb;
+    struct tcp_seg *seg;
+    int i;
+#endif
+
+    if (!(copy = mem_malloc(pkt->jp_len)))
+	return -1;
+    memcpy(copy, pkt->jp_data, pkt->jp_len);
+#if TCP_QUEUE_OOSEQ
+    // Segments share their pbufs, so check every queued one.
+    for (i = 0; i < 2; i++)
+	for (pcb = pcbs[i]; pcb; pcb = pcb->next)
+	    for (seg = pcb->ooseq; seg; seg = seg->next) {
+		rxbuf_rebase((void **) &seg->tcphdr,
+			     (u8_t *) pkt->jp_data, copy, pkt->jp_len);
+		rxbuf_rebase(&seg->dataptr,
+			     (u8_t *) pkt->jp_data, copy, pkt->jp_len);
+	    }
+#endif
+    rb->rb_pc.pbuf.payload =
+	copy + ((u8_t *) rb->rb_pc.pbuf.payload - (u8_t *) pkt->jp_data);
+    rb->rb_pc.payload_mem = copy;
+    rb->rb_copy = copy;
+    rb->rb_pkt = 0;
+    rxlent[rxslot(pkt)] = 0;
+    pktring_release(ring, pkt);
+    return 0;
+}
+
+/*
+ * low_level_copy():
  *
+ * Copy a received frame into a new PBUF_POOL chain, summing it as it
+ * goes, and release its ring slot.
  */
 static struct pbuf *
-low_level_input(void *va)
+low_level_copy(struct jif_pkt *pkt, u32_t *sum)
 {
-    struct jif_pkt *pkt = (struct jif_pkt *)va;
     s16_t len = pkt->jp_len;
 
     struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
-    if (p == 0)
+    if (p == 0) {
+	pktring_release(INRINGVA, pkt);
 	return 0;
+    }
 
     /* We iterate over the pbuf chain until we have read the entire
      * packet into the pbuf. */
     void *rxbuf = (void *) pkt->jp_data;
     int copied = 0;
     struct pbuf *q;
+    *sum = 0;
     for (q = p; q != NULL; q = q->next) {
 	/* Read enough bytes to fill this pbuf in the chain. The
 	 * available data in the pbuf is given by the q->len
@@ -139,12 +304,56 @@ low_level_input(void *va)
 	int bytes = q->len;
 	if (bytes > (len - copied))
 	    bytes = len - copied;
-	memcpy(q->payload, rxbuf + copied, bytes);
+	*sum = chksum_add(*sum, jos_chksum_copy(q->payload, rxbuf + copied, bytes),
+			  copied);
 	copied += bytes;
     }
 
+    pktring_release(INRINGVA, pkt);
+    return p;
+}
+
+/*
+ * low_level_input():
+ *
+ * Should allocate a pbuf and transfer the bytes of the incoming
+ * packet from the interface into the pbuf.  Here that means lending
+ * lwIP the input ring slot the packet is in, which must have been
+ * taken with pktring_take; the slot is released when lwIP is done.
+ *
+ */
+static struct pbuf *
+low_level_input(void *va)
+{
+    struct Pktring *ring = INRINGVA;
+    struct jif_pkt *pkt = (struct jif_pkt *)va;
+    struct rxbuf *rb;
+    struct pbuf *p;
+    u32_t sum;
+    u8_t proto;
+
+    // Leave the input helper room to work with.
+    while (ring->pr_next - ring->pr_head > RX_MAXLENT)
+	if (rxbuf_unlend() < 0)
+	    break;
+
+    if ((rb = mem_malloc(sizeof(struct rxbuf)))) {
+	rb->rb_pc.custom_free_function = rxbuf_free;
+	rb->rb_pkt = pkt;
+	rb->rb_copy = 0;
+	rxlent[rxslot(pkt)] = rb;
+	p = pbuf_alloced_custom(PBUF_REF, &rb->rb_pc, pkt->jp_data, pkt->jp_len);
+	sum = jos_chksum(pkt->jp_data, pkt->jp_len);
+    } else if (!(p = low_level_copy(pkt, &sum)))
+	return 0;
+
+    // A good TCP/UDP checksum sums to 0xffff; spare lwIP checking it.
+    if (frame_l4_sum(p->payload, p->tot_len, sum, &proto) == 0xffff)
+	p->flags |= PBUF_FLAG_CSUM_OK;
+
     return p;
 }
+
 /*
  * jif_output():
  *
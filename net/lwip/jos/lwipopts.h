@@ -10,7 +10,10 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 //#define NO_SYS 1
 
-#define LWIP_STATS		0
+// Counters only; the NS hands them out through NSREQ_STATS.  32-bit
+// counters take a long time to wrap.
+#define LWIP_STATS		1
+#define LWIP_STATS_LARGE	1
 #define LWIP_STATS_DISPLAY	0
 #define LWIP_DHCP		1
 #define LWIP_COMPAT_SOCKETS	0
@@ -24,19 +27,29 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 #define MEMP_NUM_PBUF		64
 #define MEMP_NUM_UDP_PCB	8
-#define MEMP_NUM_TCP_PCB	32
-#define MEMP_NUM_TCP_PCB_LISTEN	16
+#define MEMP_NUM_TCP_PCB	256
+#define MEMP_NUM_TCP_PCB_LISTEN	32
+#define TCP_CONN_HASH_SIZE	256
+#define TCP_LISTEN_HASH_SIZE	32
 #define MEMP_NUM_TCP_SEG	TCP_SND_QUEUELEN// at least as big as TCP_SND_QUEUELEN
 #define MEMP_NUM_NETBUF		128
 #define MEMP_NUM_NETCONN	32
 #define MEMP_NUM_SYS_TIMEOUT    6
 
-#define PER_TCP_PCB_BUFFER	(16 * 4096)
-#define MEM_SIZE		(PER_TCP_PCB_BUFFER*MEMP_NUM_TCP_SEG + 4096*MEMP_NUM_TCP_SEG)
+// mem_malloc() hands out blocks from fixed size-class pools
+// (lwippools.h) rather than carving up one big heap.
+#define MEM_USE_POOLS		1
+#define MEMP_USE_CUSTOM_POOLS	1
 
-#define PBUF_POOL_SIZE		512
+// jif lends received frames to lwIP in place, as custom pbufs; the
+// pbuf pool is only a fallback for when it can't.
+#define LWIP_SUPPORT_CUSTOM_PBUF	1
+#define PBUF_POOL_SIZE		64
 #define PBUF_POOL_BUFSIZE	2000
 
+// jif fills in TCP checksums as it copies frames out (jif.c)
+#define CHECKSUM_GEN_TCP	0
+
 #define TCP_MSS			1460
 #define TCP_WND			24000
 #define TCP_SND_BUF		(16 * TCP_MSS)
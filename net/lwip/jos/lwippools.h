@@ -0,0 +1,10 @@
+// Size classes for mem_malloc() (MEM_USE_POOLS), pulled into memp_std.h.
+// Each block also holds a small struct mem_helper.  The largest fits a
+// full-sized TCP segment or Ethernet frame behind its struct pbuf and
+// headers.  No include guard: memp_std.h includes this more than once.
+
+LWIP_MALLOC_MEMPOOL_START
+LWIP_MALLOC_MEMPOOL(256, 128)
+LWIP_MALLOC_MEMPOOL(64, 512)
+LWIP_MALLOC_MEMPOOL(256, 1600)
+LWIP_MALLOC_MEMPOOL_END
@@ -5,14 +5,18 @@
 #define MASK "255.255.255.0"
 #define DEFAULT "10.0.2.2"
 
-#define TIMER_INTERVAL 250
-
 // Virtual address at which to receive page mappings containing client requests.
+// Each slot is a window of IPC_MAXPAGES pages: the request page, then
+// any data pages lent with NSREQ_SENDV or NSREQ_RECVV.
 #define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
+#define REQSLOT		(IPC_MAXPAGES * PGSIZE)
+#define REQVA		0x20000000
 
-/* timer.c */
-void timer(envid_t ns_envid, uint32_t initial_to);
+// Where NSREQ_SENDFILE pages are kept until the peer acknowledges
+// their data: SENDFILE_NSLOT slots of up to IPC_MAXPAGES-1 pages each.
+#define SENDFILE_NSLOT	32
+#define SENDFILESLOT	((IPC_MAXPAGES - 1) * PGSIZE)
+#define SENDFILEVA	0x28000000
 
 /* input.c */
 void input(envid_t ns_envid);
@@ -20,3 +24,6 @@ void input(envid_t ns_envid);
 /* output.c */
 void output(envid_t ns_envid);
 
+/* pktring.c */
+void pktring_setup(void);
+
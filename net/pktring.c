@@ -0,0 +1,18 @@
+#include "ns.h"
+
+// Map the input and output packet rings (see inc/ns.h), empty, shared
+// with any children forked from here on.  Both consumers start out
+// asleep: the first frame on either ring wakes them.
+    void
+pktring_setup(void)
+{
+    struct Pktring *rings[2] = { INRINGVA, OUTRINGVA };
+    int i, j, r;
+
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < PKTRING_NPAGES; j++)
+            if ((r = sys_page_alloc(0, (char *) rings[i] + j * PGSIZE,
+                            PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+                panic("pktring_setup: %e", r);
+    INRINGVA->pr_wait = OUTRINGVA->pr_wait = 1;
+}
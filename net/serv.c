@@ -43,37 +43,74 @@ static struct timer_thread t_arp;
 static struct timer_thread t_tcpf;
 static struct timer_thread t_tcps;
 
-static envid_t timer_envid;
 static envid_t input_envid;
 static envid_t output_envid;
 
-static bool buse[QUEUE_SIZE];
-static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
-static int prev_i(int i) { return (i ? i-1 : QUEUE_SIZE-1); }
+// Requests are served by a fixed pool of worker threads, one for each
+// request buffer, so a buffer is free exactly when its worker is idle.
+// The free ones are kept on a stack.
+struct worker {
+    volatile uint32_t w_busy;	// set by serve() to hand over a request
+    int32_t w_reqno;
+    envid_t w_whom;
+    union Nsipc *w_req;		// this worker's buffer
+    unsigned w_npages;		// pages received, counting the request page
+    uint64_t w_start;		// read_tsc() when the request arrived
+};
+
+static struct worker workers[QUEUE_SIZE];
+static int free_bufs[QUEUE_SIZE];
+static volatile uint32_t nfree_bufs;
 
-static void *
-get_buffer(void) {
-    void *va;
+// How long serve() waits for a busy buffer to free up before it takes
+// the next message without one.
+#define STALL_MSEC	100
 
-    int64_t i;
-    for (i = 0; i < QUEUE_SIZE; i++)
-        if (!buse[i]) break;
+static struct Nsreqstat reqstats[NSREQ_NTYPES];
+static uint64_t nrefused;	// messages that arrived with no buffer free
 
-    if (i == QUEUE_SIZE) {
-        panic("NS: buffer overflow");
+    static struct worker *
+get_buffer(void)
+{
+    if (nfree_bufs == 0)
         return 0;
-    }
+    return &workers[free_bufs[--nfree_bufs]];
+}
+
+    static void
+put_buffer(struct worker *w)
+{
+    free_bufs[nfree_bufs++] = w - workers;
+    thread_wakeup(&nfree_bufs);
+}
 
-    va = (void *)(REQVA + i * PGSIZE);
-    buse[i] = 1;
+    static void
+reqstat_add(int reqno, uint64_t start)
+{
+    struct Nsreqstat *rs;
+    uint64_t cycles;
 
-    return va;
+    if (reqno <= 0 || reqno >= NSREQ_NTYPES)
+        return;
+    rs = &reqstats[reqno];
+    cycles = read_tsc() - start;
+    rs->rs_count++;
+    rs->rs_cycles += cycles;
+    rs->rs_max = MAX(rs->rs_max, cycles);
 }
 
-static void
-put_buffer(void *va) {
-    int64_t i = ((uint64_t)va - REQVA) / PGSIZE;
-    buse[i] = 0;
+    static void
+reqstats_print(void)
+{
+    int i;
+
+    for (i = 0; i < NSREQ_NTYPES; i++)
+        if (reqstats[i].rs_count)
+            cprintf("ns req %d: %lu served, avg %lu max %lu cycles\n", i,
+                    reqstats[i].rs_count,
+                    reqstats[i].rs_cycles / reqstats[i].rs_count,
+                    reqstats[i].rs_max);
+    cprintf("ns: %lu refused for lack of buffers\n", nrefused);
 }
 
     static void
@@ -160,36 +197,290 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
     cprintf("NS: TCP/IP initialized.\n");
 }
 
+// NSREQ_SENDFILE pages are mapped into a slot at SENDFILEVA and sent
+// from there without copying.  A slot can be reused once none of the
+// TCP segments still waiting to be sent or acknowledged points into
+// it: lwIP frees those, or hands them to the ARP queue as copies, and
+// the jif driver copies what it transmits.
+struct sendfile_slot {
+    unsigned sf_npages;		// pages mapped, 0 if the slot is free
+    bool sf_writing;		// lwIP is still taking the data
+};
+
+static struct sendfile_slot sendfile_slots[SENDFILE_NSLOT];
+static int sendfile_nbusy;
+
+// Bumped after every batch of input, which may acknowledge data.
+static volatile uint32_t ninput;
+
+// How long a sendfile waits for a slot before checking again anyway.
+#define SENDFILE_WAIT_MSEC	TCP_SLOW_INTERVAL
+
+    static void *
+sendfile_va(int i)
+{
+    return (char *) SENDFILEVA + i * SENDFILESLOT;
+}
+
+    static void
+sendfile_mark(struct tcp_seg *seg, bool *inuse)
+{
+    struct pbuf *q;
+    uintptr_t off;
+
+    for (; seg; seg = seg->next)
+        for (q = seg->p; q; q = q->next) {
+            off = (uintptr_t) q->payload - SENDFILEVA;
+            if (q->type == PBUF_REF && off < SENDFILE_NSLOT * SENDFILESLOT)
+                inuse[off / SENDFILESLOT] = 1;
+        }
+}
+
+// Unmap the slots no TCP segment refers to any more.
+    static void
+sendfile_reap(void)
+{
+    bool inuse[SENDFILE_NSLOT];
+    struct tcp_pcb *pcb;
+    struct sendfile_slot *sf;
+    unsigned i;
+    int j;
+
+    memset(inuse, 0, sizeof(inuse));
+    for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        sendfile_mark(pcb->unsent, inuse);
+        sendfile_mark(pcb->unacked, inuse);
+    }
+    for (j = 0; j < SENDFILE_NSLOT; j++) {
+        sf = &sendfile_slots[j];
+        if (!sf->sf_npages || sf->sf_writing || inuse[j])
+            continue;
+        for (i = 0; i < sf->sf_npages; i++)
+            sys_page_unmap(0, (char *) sendfile_va(j) + i * PGSIZE);
+        sf->sf_npages = 0;
+        sendfile_nbusy--;
+    }
+}
+
+// Find a free slot, waiting for acknowledgements to free one up if
+// need be.
+    static int
+sendfile_alloc(void)
+{
+    uint32_t n;
+    int j;
+
+    for (;;) {
+        if (sendfile_nbusy == SENDFILE_NSLOT)
+            sendfile_reap();
+        for (j = 0; j < SENDFILE_NSLOT; j++)
+            if (!sendfile_slots[j].sf_npages)
+                return j;
+        n = ninput;
+        thread_wait(&ninput, n, sys_time_msec() + SENDFILE_WAIT_MSEC);
+    }
+}
+
+// Timers: rather than being woken on a fixed tick, the NS keeps a
+// kernel alarm (sys_ipc_alarm) armed for the earliest deadline any of
+// its threads is waiting on, whether a timer thread or a sleep in
+// sys_arch, which is where lwIP's sys_timeout lists wait.  The alarm
+// arrives as an NSREQ_TIMER message from ourselves.
+
+// The deadline our alarm is armed for, 0 if none.
+static uint32_t alarm_msec;
+
+// Arm the alarm for the next thread deadline, if that has changed.
 static void
-process_timer(envid_t envid) {
-    uint32_t start, now, to;
+timer_arm(void) {
+    uint32_t next = thread_next_deadline();
+    int r;
 
-    if (envid != timer_envid) {
-        cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
+    if (next == alarm_msec)
+        return;
+    if ((r = sys_ipc_alarm(next, NSREQ_TIMER)) < 0)
+        panic("sys_ipc_alarm: %e", r);
+    alarm_msec = next;
+}
+
+// A thread deadline has passed: let the threads run.
+static void
+process_timer(envid_t envid) {
+    if (envid != thisenv->env_id) {
+        cprintf("NS: received timer message from envid %x not our alarm\n", envid);
         return;
     }
 
-    start = sys_time_msec();
+    // The kernel disarms an alarm once it is delivered.
+    alarm_msec = 0;
     thread_yield();
-    now = sys_time_msec();
 
-    to = TIMER_INTERVAL - (now - start);
-    ipc_send(envid, to, 0, 0);
+    if (sendfile_nbusy)
+        sendfile_reap();
+
+    if (debug)
+        reqstats_print();
 }
 
-struct st_args {
-    int32_t reqno;
-    uint32_t whom;
-    union Nsipc *req;
-};
+// Feed everything on the input ring to lwIP, then ask the input helper
+// to tell us when there is more.
+static void
+process_input(envid_t envid) {
+    struct jif_pkt *pkt;
+
+    if (envid != input_envid) {
+        cprintf("NS: received input notice from envid %x not input env\n", envid);
+        return;
+    }
+
+    do {
+        // jif lends each frame to lwIP in place, and releases the
+        // slot once lwIP is done with it.
+        while ((pkt = pktring_peek(INRINGVA))) {
+            pktring_take(INRINGVA);
+            jif_input(&nif, pkt);
+        }
+    } while (!pktring_arm(INRINGVA));
+
+    ninput++;
+    thread_wakeup(&ninput);
+}
+
+// Snapshot the server's counters, and lwIP's, into ret.
+    static int
+serve_stats(struct Nsret_stats *ret)
+{
+    static_assert(sizeof(struct Nsret_stats) <= PGSIZE);
+
+    ret->ret_tsc = read_tsc();
+    ret->ret_msec = sys_time_msec();
+    ret->ret_nworkers = QUEUE_SIZE;
+    ret->ret_nbusy = QUEUE_SIZE - nfree_bufs;
+    ret->ret_inring = INRINGVA->pr_tail - INRINGVA->pr_next;
+    ret->ret_inlent = INRINGVA->pr_next - INRINGVA->pr_head;
+    ret->ret_outring = OUTRINGVA->pr_tail - OUTRINGVA->pr_head;
+    ret->ret_nrefused = nrefused;
+    memcpy(ret->ret_req, reqstats, sizeof reqstats);
+    memcpy(&ret->ret_lwip, &lwip_stats, sizeof lwip_stats);
+    return 0;
+}
+
+// Wait for events on the sockets in req, up to req_timeout msec,
+// using lwip_select (and so lwIP's socket event callbacks) to block
+// just this thread.  Sets each entry's revents and returns the number
+// of entries with any.
+    static int
+serve_poll(struct Nsreq_poll *req)
+{
+    fd_set rset, wset;
+    struct timeval tv, *tvp;
+    struct pollfd *pfd;
+    int i, n, r, maxfd;
+
+    if (req->req_nfds < 0 || req->req_nfds > (int) NSPOLL_MAX)
+        return -E_INVAL;
+
+    FD_ZERO(&rset);
+    FD_ZERO(&wset);
+    maxfd = -1;
+    n = 0;
+    for (i = 0; i < req->req_nfds; i++) {
+        pfd = &req->req_fds[i];
+        pfd->revents = 0;
+        if (pfd->fd < 0)
+            continue;
+        if (pfd->fd >= FD_SETSIZE) {
+            pfd->revents = POLLNVAL;
+            n++;
+            continue;
+        }
+        if (pfd->events & POLLIN)
+            FD_SET(pfd->fd, &rset);
+        if (pfd->events & POLLOUT)
+            FD_SET(pfd->fd, &wset);
+        maxfd = MAX(maxfd, pfd->fd);
+    }
+
+    // Don't wait if some entries are already bad.
+    if (n > 0)
+        req->req_timeout = 0;
+    tvp = 0;
+    if (req->req_timeout >= 0) {
+        tv.tv_sec = req->req_timeout / 1000;
+        tv.tv_usec = (req->req_timeout % 1000) * 1000;
+        tvp = &tv;
+    }
+    if ((r = lwip_select(maxfd + 1, &rset, &wset, 0, tvp)) < 0)
+        return r;
+
+    for (i = 0; i < req->req_nfds; i++) {
+        pfd = &req->req_fds[i];
+        if (pfd->fd < 0 || pfd->fd >= FD_SETSIZE)
+            continue;
+        if ((pfd->events & POLLIN) && FD_ISSET(pfd->fd, &rset))
+            pfd->revents |= POLLIN;
+        if ((pfd->events & POLLOUT) && FD_ISSET(pfd->fd, &wset))
+            pfd->revents |= POLLOUT;
+        if (pfd->revents)
+            n++;
+    }
+    return n;
+}
+
+// The data lent with an NSREQ_SENDV or NSREQ_RECVV, which starts off
+// bytes into the page after the request and runs for len bytes, or
+// 0 if that doesn't fit in the pages that came with the request.
+    static char *
+lent_data(struct worker *w, int off, int len)
+{
+    if (off < 0 || off >= PGSIZE || len < 0
+            || off + len > (int) (w->w_npages - 1) * PGSIZE)
+        return 0;
+    return (char *) w->w_req + PGSIZE + off;
+}
+
+// Send the file data lent with an NSREQ_SENDFILE.  The pages move to
+// a sendfile slot, and lwIP sends from them there; they stay mapped
+// after we reply, until the peer has acknowledged everything in them.
+    static int
+serve_sendfile(struct worker *w, struct Nsreq_sendv *req)
+{
+    struct sendfile_slot *sf;
+    unsigned i, npages;
+    char *buf;
+    int j, r;
+
+    if (!(buf = lent_data(w, req->req_off, req->req_size)))
+        return -E_INVAL;
+    npages = ROUNDUP(req->req_off + req->req_size, PGSIZE) / PGSIZE;
+
+    j = sendfile_alloc();
+    sf = &sendfile_slots[j];
+    for (i = 0; i < npages; i++)
+        if ((r = sys_page_map(0, buf - req->req_off + i * PGSIZE,
+                        0, (char *) sendfile_va(j) + i * PGSIZE, PTE_P|PTE_U)) < 0) {
+            while (i-- > 0)
+                sys_page_unmap(0, (char *) sendfile_va(j) + i * PGSIZE);
+            return r;
+        }
+    sf->sf_npages = npages;
+    sf->sf_writing = 1;
+    sendfile_nbusy++;
+
+    r = lwip_send_nocopy(req->req_s, (char *) sendfile_va(j) + req->req_off,
+            req->req_size, req->req_flags);
+    sf->sf_writing = 0;
+    return r;
+}
 
 static void
-serve_thread(uint64_t a) {
-    struct st_args *args = (struct st_args *)a;
-    union Nsipc *req = args->req;
+serve_request(struct worker *w) {
+    union Nsipc *req = w->w_req;
+    unsigned i;
+    char *buf;
     int r;
 
-    switch (args->reqno) {
+    switch (w->w_reqno) {
         case NSREQ_ACCEPT:
             {
                 struct Nsret_accept ret;
@@ -225,40 +516,86 @@ serve_thread(uint64_t a) {
             r = lwip_send(req->send.req_s, &req->send.req_buf,
                     req->send.req_size, req->send.req_flags);
             break;
+        case NSREQ_SENDV:
+            if (!(buf = lent_data(w, req->sendv.req_off, req->sendv.req_size))) {
+                r = -E_INVAL;
+                break;
+            }
+            r = lwip_send(req->sendv.req_s, buf, req->sendv.req_size,
+                    req->sendv.req_flags);
+            break;
+        case NSREQ_SENDFILE:
+            r = serve_sendfile(w, &req->sendv);
+            break;
+        case NSREQ_RECVV:
+            if (!(buf = lent_data(w, req->recvv.req_off, req->recvv.req_len))) {
+                r = -E_INVAL;
+                break;
+            }
+            r = lwip_recv(req->recvv.req_s, buf, req->recvv.req_len,
+                    req->recvv.req_flags);
+            break;
+        case NSREQ_POLL:
+            r = serve_poll(&req->poll);
+            break;
         case NSREQ_SOCKET:
             r = lwip_socket(req->socket.req_domain, req->socket.req_type,
                     req->socket.req_protocol);
             break;
-        case NSREQ_INPUT:
-            jif_input(&nif, (void *)&req->pkt);
-            r = 0;
+        case NSREQ_STATS:
+            r = serve_stats(&req->statsRet);
             break;
         default:
-            cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
+            cprintf("Invalid request code %d from %08x\n", w->w_reqno, w->w_whom);
             r = -E_INVAL;
             break;
     }
 
     if (r == -1) {
         char buf[100];
-        snprintf(buf, sizeof buf, "ns req type %d", args->reqno);
+        snprintf(buf, sizeof buf, "ns req type %d", w->w_reqno);
         perror(buf);
     }
 
-    if (args->reqno != NSREQ_INPUT)
-        ipc_send(args->whom, r, 0, 0);
+    ipc_send(w->w_whom, r, 0, 0);
+    reqstat_add(w->w_reqno, w->w_start);
 
-    put_buffer(args->req);
-    sys_page_unmap(0, (void*) args->req);
-    free(args);
+    for (i = 0; i < w->w_npages; i++)
+        sys_page_unmap(0, (char *) req + i * PGSIZE);
+}
+
+    static void
+serve_worker(uint64_t a)
+{
+    struct worker *w = (struct worker *) a;
+
+    for (;;) {
+        thread_wait(&w->w_busy, 0, (uint32_t) ~0);
+        if (!w->w_busy)
+            continue;
+        serve_request(w);
+        w->w_busy = 0;
+        put_buffer(w);
+    }
 }
 
 void
 serve(void) {
     int32_t reqno;
     uint32_t whom;
-    int i, perm;
-    void *va;
+    unsigned npages;
+    struct worker *w;
+    uint64_t start;
+    int i, r, perm;
+
+    for (i = 0; i < QUEUE_SIZE; i++) {
+        workers[i].w_req = (union Nsipc *) (uintptr_t) (REQVA + i * REQSLOT);
+        free_bufs[i] = QUEUE_SIZE - 1 - i;
+        r = thread_create(0, "serve_worker", serve_worker, (uint64_t) &workers[i]);
+        if (r < 0)
+            panic("cannot create worker thread: %s", e2s(r));
+    }
+    nfree_bufs = QUEUE_SIZE;
 
     while (1) {
         // ipc_recv will block the entire process, so we flush
@@ -267,38 +604,59 @@ serve(void) {
         for (i = 0; thread_wakeups_pending() && i < 32; ++i)
             thread_yield();
 
+        // With every buffer busy, leave new requests queued in the
+        // kernel, their senders blocked, until a worker finishes.
+        if (nfree_bufs == 0)
+            thread_wait(&nfree_bufs, 0, sys_time_msec() + STALL_MSEC);
+
+        // If that took too long, the workers may all be waiting for
+        // network input, which itself is announced by IPC.  So take
+        // the next message anyway, without a page: timer alarms and
+        // input are served as usual, and anything else is turned away.
         perm = 0;
-        va = get_buffer();
-        reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+        w = get_buffer();
+        timer_arm();
+        reqno = ipc_recvv((envid_t *) &whom, w ? (void *) w->w_req : 0,
+                IPC_MAXPAGES, &npages, &perm);
         if (debug) {
             cprintf("ns req %d from %08x\n", reqno, whom);
         }
 
         // first take care of requests that do not contain an argument page
-        if (reqno == NSREQ_TIMER) {
-            process_timer(whom);
-            put_buffer(va);
+        if (reqno == NSREQ_TIMER || reqno == NSREQ_INPUT) {
+            start = read_tsc();
+            if (reqno == NSREQ_TIMER)
+                process_timer(whom);
+            else
+                process_input(whom);
+            reqstat_add(reqno, start);
+            if (w)
+                put_buffer(w);
+            continue;
+        }
+
+        if (!w) {
+            nrefused++;
+            ipc_send(whom, -E_NO_MEM, 0, 0);
             continue;
         }
 
         // All remaining requests must contain an argument page
         if (!(perm & PTE_P)) {
             cprintf("Invalid request from %08x: no argument page\n", whom);
+            put_buffer(w);
             continue; // just leave it hanging...
         }
 
-        // Since some lwIP socket calls will block, create a thread and
-        // process the rest of the request in the thread.
-        struct st_args *args = malloc(sizeof(struct st_args));
-        if (!args)
-            panic("could not allocate thread args structure");
-
-        args->reqno = reqno;
-        args->whom = whom;
-        args->req = va;
-
-        thread_create(0, "serve_thread", serve_thread, (uint64_t)args);
-        thread_yield(); // let the thread created run
+        // Since some lwIP socket calls will block, hand the request to
+        // this buffer's worker thread.
+        w->w_reqno = reqno;
+        w->w_whom = whom;
+        w->w_npages = npages;
+        w->w_start = read_tsc();
+        w->w_busy = 1;
+        thread_wakeup(&w->w_busy);
+        thread_yield(); // let the worker run
     }
 }
 
@@ -317,14 +675,8 @@ umain(int argc, char **argv)
 
     binaryname = "ns";
 
-    // fork off the timer thread which will send us periodic messages
-    timer_envid = fork();
-    if (timer_envid < 0)
-        panic("error forking");
-    else if (timer_envid == 0) {
-        timer(ns_envid, TIMER_INTERVAL);
-        return;
-    }
+    // map the packet rings the input and output helpers will share
+    pktring_setup();
 
     // fork off the input thread which will poll the NIC driver for input
     // packets
@@ -0,0 +1,118 @@
+// Check jos_chksum and jos_chksum_copy against lwIP's portable
+// checksum, then time them over a range of buffer sizes.
+//
+// Usage: testchksum [rounds]
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#include <lwip/def.h>
+
+#define DEFAULT_ROUNDS	2000
+
+static const u16_t sizes[] = { 20, 40, 64, 576, 1460, 1514, 4096 };
+
+static u8_t src[4096 + 8];
+static u8_t dst[4096 + 8];
+
+// lwIP's own routine (inet_chksum.c, LWIP_CHKSUM_ALGORITHM 1), which
+// it used before jos_chksum.
+    static u16_t
+standard_chksum(void *dataptr, u16_t len)
+{
+    u32_t acc = 0;
+    u16_t w;
+    u8_t *octetptr = dataptr;
+
+    while (len > 1) {
+        w = (*octetptr) << 8;
+        octetptr++;
+        w |= (*octetptr);
+        octetptr++;
+        acc += w;
+        len -= 2;
+    }
+    if (len > 0) {
+        w = (*octetptr) << 8;
+        acc += w;
+    }
+    acc = (acc >> 16) + (acc & 0x0000ffffUL);
+    if ((acc & 0xffff0000) != 0)
+        acc = (acc >> 16) + (acc & 0x0000ffffUL);
+    return htons((u16_t) acc);
+}
+
+    static void
+check(void)
+{
+    u32_t seed = 1;
+    u16_t want, len;
+    int off, i, fill;
+
+    for (fill = 0; fill < 3; fill++) {
+        for (i = 0; i < (int) sizeof(src); i++) {
+            seed = seed * 1103515245 + 12345;
+            src[i] = fill == 0 ? seed >> 16 : fill == 1 ? 0xff : 0;
+        }
+        for (len = 0; len <= 4096; len += len < 80 ? 1 : 61)
+            for (off = 0; off < 8; off++) {
+                want = standard_chksum(src + off, len);
+                if (jos_chksum(src + off, len) != want)
+                    panic("jos_chksum: len %d off %d: %x, want %x",
+                          len, off, jos_chksum(src + off, len), want);
+                if (jos_chksum_copy(dst + (off ^ 5), src + off, len) != want
+                    || memcmp(dst + (off ^ 5), src + off, len) != 0)
+                    panic("jos_chksum_copy: len %d off %d", len, off);
+            }
+    }
+}
+
+    void
+umain(int argc, char **argv)
+{
+    uint32_t rounds = DEFAULT_ROUNDS, r;
+    uint64_t start, t_std, t_new, t_memsum, t_copy;
+    volatile u16_t sink;
+    int i;
+    u16_t len;
+
+    binaryname = "testchksum";
+    if (argc > 1)
+        rounds = strtol(argv[1], 0, 0);
+
+    check();
+    cprintf("testchksum: results match\n");
+
+    cprintf("%6s %10s %10s %14s %10s  (cycles/call)\n",
+            "bytes", "standard", "jos", "memcpy+jos", "jos_copy");
+    for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+        len = sizes[i];
+
+        start = read_tsc();
+        for (r = 0; r < rounds; r++)
+            sink = standard_chksum(src, len);
+        t_std = read_tsc() - start;
+
+        start = read_tsc();
+        for (r = 0; r < rounds; r++)
+            sink = jos_chksum(src, len);
+        t_new = read_tsc() - start;
+
+        start = read_tsc();
+        for (r = 0; r < rounds; r++) {
+            memcpy(dst, src, len);
+            sink = jos_chksum(dst, len);
+        }
+        t_memsum = read_tsc() - start;
+
+        start = read_tsc();
+        for (r = 0; r < rounds; r++)
+            sink = jos_chksum_copy(dst, src, len);
+        t_copy = read_tsc() - start;
+
+        cprintf("%6d %10ld %10ld %14ld %10ld\n", len,
+                (long) (t_std / rounds), (long) (t_new / rounds),
+                (long) (t_memsum / rounds), (long) (t_copy / rounds));
+    }
+    (void) sink;
+}
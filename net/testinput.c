@@ -4,8 +4,6 @@
 static envid_t output_envid;
 static envid_t input_envid;
 
-static struct jif_pkt *pkt = (struct jif_pkt*)REQVA;
-
 
     static void
 announce(void)
@@ -19,10 +17,7 @@ announce(void)
     uint8_t mac[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
     uint32_t myip = inet_addr(IP);
     uint32_t gwip = inet_addr(DEFAULT);
-    int r;
-
-    if ((r = sys_page_alloc(0, pkt, PTE_P|PTE_U|PTE_W)) < 0)
-        panic("sys_page_map: %e", r);
+    struct jif_pkt *pkt = pktring_free_slot(OUTRINGVA);
 
     struct etharp_hdr *arp = (struct etharp_hdr*)pkt->jp_data;
     pkt->jp_len = sizeof(*arp);
@@ -39,8 +34,8 @@ announce(void)
     memset(arp->dhwaddr.addr,  0x00,  ETHARP_HWADDR_LEN);
     memcpy(arp->dipaddr.addrw, &gwip, 4);
 
-    ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, pkt);
+    if (pktring_produce(OUTRINGVA))
+        sys_futex_wake(&OUTRINGVA->pr_tail, 1);
 }
 
     static void
@@ -72,6 +67,8 @@ umain(int argc, char **argv)
 
     binaryname = "testinput";
 
+    pktring_setup();
+
     output_envid = fork();
     if (output_envid < 0)
         panic("error forking");
@@ -93,9 +90,9 @@ umain(int argc, char **argv)
 
     while (1) {
         envid_t whom;
-        int perm;
+        struct jif_pkt *pkt;
 
-        int32_t req = ipc_recv((int32_t *)&whom, pkt, &perm);
+        int32_t req = ipc_recv((int32_t *)&whom, 0, 0);
         if (req < 0)
             panic("ipc_recv: %e", req);
         if (whom != input_envid)
@@ -103,13 +100,18 @@ umain(int argc, char **argv)
         if (req != NSREQ_INPUT)
             panic("Unexpected IPC %d", req);
 
-        hexdump("input: ", pkt->jp_data, pkt->jp_len);
-        cprintf("\n");
-
-        // Only indicate that we're waiting for packets once
-        // we've received the ARP reply
-        if (first)
-            cprintf("Waiting for packets...\n");
-        first = 0;
+        do {
+            while ((pkt = pktring_peek(INRINGVA))) {
+                hexdump("input: ", pkt->jp_data, pkt->jp_len);
+                cprintf("\n");
+                pktring_consume(INRINGVA);
+
+                // Only indicate that we're waiting for packets once
+                // we've received the ARP reply
+                if (first)
+                    cprintf("Waiting for packets...\n");
+                first = 0;
+            }
+        } while (!pktring_arm(INRINGVA));
     }
 }
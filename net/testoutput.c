@@ -6,17 +6,19 @@
 
 static envid_t output_envid;
 
-static struct jif_pkt *pkt = (struct jif_pkt*)REQVA;
 
 
     void
 umain(int argc, char **argv)
 {
     envid_t ns_envid = sys_getenvid();
-    int i, r;
+    struct jif_pkt *pkt;
+    int i;
 
     binaryname = "testoutput";
 
+    pktring_setup();
+
     output_envid = fork();
     if (output_envid < 0)
         panic("error forking");
@@ -26,14 +28,13 @@ umain(int argc, char **argv)
     }
 
     for (i = 0; i < TESTOUTPUT_COUNT; i++) {
-        if ((r = sys_page_alloc(0, pkt, PTE_P|PTE_U|PTE_W)) < 0)
-            panic("sys_page_alloc: %e", r);
-        pkt->jp_len = snprintf(pkt->jp_data,
-                PGSIZE - sizeof(pkt->jp_len),
+        while (!(pkt = pktring_free_slot(OUTRINGVA)))
+            sys_yield();
+        pkt->jp_len = snprintf(pkt->jp_data, PKTRING_MAXLEN,
                 "Packet %02d", i);
         cprintf("Transmitting packet %d\n", i);
-        ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
-        sys_page_unmap(0, pkt);
+        if (pktring_produce(OUTRINGVA))
+            sys_futex_wake(&OUTRINGVA->pr_tail, 1);
     }
 
     // Spin for a while, just in case IPC's or packets need to be flushed
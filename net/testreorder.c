@@ -0,0 +1,245 @@
+// Feed lwIP a TCP stream through the input ring out of order and with
+// a segment lost, while enough other frames go by that jif has to
+// move the queued segments' frames off the ring, and check that the
+// stream comes out intact.  Runs the stack in this env: no timers,
+// no output helper.
+
+#include "ns.h"
+
+#include <lwip/init.h>
+#include <lwip/ip.h>
+#include <lwip/tcp.h>
+#include <lwip/inet_chksum.h>
+#include <netif/etharp.h>
+#include <jif/jif.h>
+
+#define PEER		DEFAULT
+#define PORT		80
+#define NSEG		8
+#define SEGLEN		536
+#define PEER_ISN	1000
+#define NFILLER		(2 * PKTRING_NSLOT)
+
+/* errno to make lwIP happy */
+int errno;
+
+static struct netif nif;
+static envid_t output_envid;
+static const uint8_t peer_mac[6] = { 0x52, 0x55, 0x0a, 0x00, 0x02, 0x02 };
+
+static u8_t stream[NSEG * SEGLEN];
+static u8_t rcvd[NSEG * SEGLEN];
+static int nrcvd;
+
+// Flags, seqno and ackno of the last TCP segment lwIP sent.
+static u8_t last_flags;
+static u32_t last_seqno, last_ackno;
+static u32_t iss;		// lwIP's initial sequence number
+
+    static err_t
+recv_cb(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    if (!p)
+        panic("testreorder: connection closed");
+    if (nrcvd + p->tot_len > (int) sizeof(rcvd))
+        panic("testreorder: received %d bytes too many",
+              nrcvd + p->tot_len - (int) sizeof(rcvd));
+    pbuf_copy_partial(p, rcvd + nrcvd, p->tot_len, 0);
+    nrcvd += p->tot_len;
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+    static err_t
+accept_cb(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    tcp_accepted((struct tcp_pcb *) arg);
+    tcp_recv(pcb, recv_cb);
+    return ERR_OK;
+}
+
+// Hand lwIP everything on the input ring, then pick lwIP's replies
+// off the output ring.
+    static void
+deliver(void)
+{
+    struct jif_pkt *pkt;
+    struct eth_hdr *eth;
+    struct ip_hdr *ip;
+    struct tcp_hdr *tcp;
+
+    while ((pkt = pktring_peek(INRINGVA))) {
+        pktring_take(INRINGVA);
+        jif_input(&nif, pkt);
+    }
+
+    while ((pkt = pktring_peek(OUTRINGVA))) {
+        eth = (struct eth_hdr *) pkt->jp_data;
+        ip = (struct ip_hdr *) (eth + 1);
+        if (eth->type == htons(ETHTYPE_IP) && IPH_PROTO(ip) == IP_PROTO_TCP) {
+            tcp = (struct tcp_hdr *) ((u8_t *) ip + IPH_HL(ip) * 4);
+            last_flags = TCPH_FLAGS(tcp);
+            last_seqno = ntohl(tcp->seqno);
+            last_ackno = ntohl(tcp->ackno);
+        }
+        pktring_consume(OUTRINGVA);
+    }
+}
+
+    static struct jif_pkt *
+frame_alloc(u16_t type, int len)
+{
+    struct jif_pkt *pkt;
+    struct eth_hdr *eth;
+
+    if (!(pkt = pktring_free_slot(INRINGVA)))
+        panic("testreorder: input ring full");
+    memset(pkt->jp_data, 0, len);
+    pkt->jp_len = len;
+    eth = (struct eth_hdr *) pkt->jp_data;
+    memcpy(eth->dest.addr, nif.hwaddr, ETHARP_HWADDR_LEN);
+    memcpy(eth->src.addr, peer_mac, ETHARP_HWADDR_LEN);
+    eth->type = htons(type);
+    return pkt;
+}
+
+// Send lwIP a segment from the peer carrying stream[off, off + len).
+    static void
+send_tcp(u8_t flags, u32_t seqno, u32_t ackno, int off, int len)
+{
+    static u8_t sumbuf[12 + TCP_HLEN + SEGLEN];
+    static u16_t ipid;
+    int tcplen = TCP_HLEN + len;
+    struct jif_pkt *pkt;
+    struct ip_hdr *ip;
+    struct tcp_hdr *tcp;
+
+    pkt = frame_alloc(ETHTYPE_IP, sizeof(struct eth_hdr) + IP_HLEN + tcplen);
+    ip = (struct ip_hdr *) (pkt->jp_data + sizeof(struct eth_hdr));
+    tcp = (struct tcp_hdr *) (ip + 1);
+
+    IPH_VHLTOS_SET(ip, 4, IP_HLEN / 4, 0);
+    IPH_LEN_SET(ip, htons(IP_HLEN + tcplen));
+    IPH_ID_SET(ip, htons(ipid++));
+    IPH_TTL_SET(ip, 64);
+    IPH_PROTO_SET(ip, IP_PROTO_TCP);
+    ip->src.addr = inet_addr(PEER);
+    ip->dest.addr = nif.ip_addr.addr;
+    IPH_CHKSUM_SET(ip, inet_chksum(ip, IP_HLEN));
+
+    tcp->src = htons(4321);
+    tcp->dest = htons(PORT);
+    tcp->seqno = htonl(seqno);
+    tcp->ackno = htonl(ackno);
+    TCPH_HDRLEN_SET(tcp, TCP_HLEN / 4);
+    TCPH_FLAGS_SET(tcp, flags);
+    tcp->wnd = htons(8192);
+    memcpy(tcp + 1, stream + off, len);
+
+    // Checksum over the pseudo-header, then the segment.
+    memcpy(sumbuf, &ip->src, 4);
+    memcpy(sumbuf + 4, &ip->dest, 4);
+    sumbuf[8] = 0;
+    sumbuf[9] = IP_PROTO_TCP;
+    sumbuf[10] = tcplen >> 8;
+    sumbuf[11] = tcplen;
+    memcpy(sumbuf + 12, tcp, tcplen);
+    tcp->chksum = inet_chksum(sumbuf, 12 + tcplen);
+
+    pktring_produce(INRINGVA);
+    deliver();
+}
+
+    static void
+send_seg(int i)
+{
+    send_tcp(TCP_ACK, PEER_ISN + 1 + i * SEGLEN, iss + 1,
+             i * SEGLEN, SEGLEN);
+}
+
+// A full-sized frame lwIP just drops, to move the ring along.
+    static void
+send_filler(void)
+{
+    struct jif_pkt *pkt = frame_alloc(0x88b5, 1514);
+
+    memset(pkt->jp_data + sizeof(struct eth_hdr), 0xa5,
+           1514 - sizeof(struct eth_hdr));
+    pktring_produce(INRINGVA);
+    deliver();
+}
+
+    void
+umain(int argc, char **argv)
+{
+    struct ip_addr ipaddr, netmask, gw;
+    struct tcp_pcb *pcb;
+    int i;
+
+    binaryname = "testreorder";
+
+    for (i = 0; i < (int) sizeof(stream); i++)
+        stream[i] = i * 131 + (i >> 8);
+
+    pktring_setup();
+    lwip_init();
+    ipaddr.addr = inet_addr(IP);
+    netmask.addr = inet_addr(MASK);
+    gw.addr = inet_addr(DEFAULT);
+    if (!netif_add(&nif, &ipaddr, &netmask, &gw, &output_envid,
+                   jif_init, ip_input))
+        panic("testreorder: netif_add failed");
+    netif_set_default(&nif);
+    netif_set_up(&nif);
+
+    if (!(pcb = tcp_new()) || tcp_bind(pcb, IP_ADDR_ANY, PORT) != ERR_OK
+        || !(pcb = tcp_listen(pcb)))
+        panic("testreorder: cannot listen");
+    tcp_arg(pcb, pcb);
+    tcp_accept(pcb, accept_cb);
+
+    // Handshake.
+    deliver();
+    send_tcp(TCP_SYN, PEER_ISN, 0, 0, 0);
+    if (last_flags != (TCP_SYN | TCP_ACK) || last_ackno != PEER_ISN + 1)
+        panic("testreorder: no SYN-ACK (flags %x ackno %u)",
+              last_flags, last_ackno);
+    iss = last_seqno;
+    send_tcp(TCP_ACK, PEER_ISN + 1, iss + 1, 0, 0);
+
+    // Segments 1, 3 and 7 arrive early and segment 5 is lost; lwIP
+    // queues the early ones, keeping their ring slots.
+    send_seg(1);
+    send_seg(3);
+    send_seg(7);
+    if (nrcvd != 0)
+        panic("testreorder: %d bytes delivered out of order", nrcvd);
+
+    // Cycle through the ring twice, so jif must move the queued
+    // frames off it and every slot they were in gets overwritten.
+    for (i = 0; i < NFILLER; i++)
+        send_filler();
+
+    // The gaps fill in, with 5 retransmitted after 4.
+    send_seg(0);
+    send_seg(2);
+    send_seg(4);
+    if (nrcvd != 5 * SEGLEN)
+        panic("testreorder: %d bytes delivered, want %d",
+              nrcvd, 5 * SEGLEN);
+    send_seg(5);
+    send_seg(6);
+
+    tcp_fasttmr();	// flush the delayed ACK
+    deliver();
+    if (nrcvd != (int) sizeof(stream))
+        panic("testreorder: %d bytes delivered, want %d",
+              nrcvd, (int) sizeof(stream));
+    if (memcmp(rcvd, stream, sizeof(stream)) != 0)
+        panic("testreorder: stream corrupted");
+    if (last_ackno != PEER_ISN + 1 + sizeof(stream))
+        panic("testreorder: last ACK %u, want %u", last_ackno,
+              PEER_ISN + 1 + (u32_t) sizeof(stream));
+    cprintf("testreorder: OK\n");
+}
@@ -13,8 +13,11 @@ umain(int argc, char **argv)
     // a better way would be to use the processor's HLT instruction
     // to cause the processor to stop executing until the next interrupt -
     // doing so allows the processor to conserve power more effectively.
+    // Meanwhile, zero a few free pages each time around, so that page
+    // faults and forks find zeroed pages waiting.
     while (1) {
      //   cprintf("...Idle...");
+        sys_page_prezero(16);
         sys_yield();
     }
 }
@@ -2,6 +2,11 @@
 
 int flag[256];
 
+// Directory reads lsdir keeps queued on the file server's ring.
+#define LSDIR_NREAD	8
+
+static struct File dirbuf[LSDIR_NREAD][BLKFILES];
+
 void lsdir(const char*, const char*);
 void ls1(const char*, bool, off_t, const char*);
 
@@ -22,18 +27,33 @@ ls(const char *path, const char *prefix)
     void
 lsdir(const char *path, const char *prefix)
 {
-    int fd, n;
-    struct File f;
+    int fd, n, i, r, queued;
+    struct File *f;
 
     if ((fd = open(path, O_RDONLY)) < 0)
         panic("open %s: %e", path, fd);
-    while ((n = readn(fd, &f, sizeof f)) == sizeof f)
-        if (f.f_name[0])
-            ls1(prefix, f.f_type==FTYPE_DIR, f.f_size, f.f_name);
-    if (n > 0)
-        panic("short read in directory %s", path);
-    if (n < 0)
-        panic("error reading directory %s: %e", path, n);
+
+    // Queue a block's worth of entries per read and reap the reads in
+    // order, queueing the next one into each buffer as it empties.
+    for (i = 0; i < LSDIR_NREAD; i++)
+        if ((r = fsring_read(fd, dirbuf[i], sizeof dirbuf[i])) < 0)
+            panic("error reading directory %s: %e", path, r);
+    for (queued = LSDIR_NREAD, i = 0; queued > 0;
+         queued--, i = (i + 1) % LSDIR_NREAD) {
+        if ((n = fsring_reap(0)) < 0)
+            panic("error reading directory %s: %e", path, n);
+        if (n % sizeof(struct File))
+            panic("short read in directory %s", path);
+        for (f = dirbuf[i]; f < dirbuf[i] + n / sizeof(struct File); f++)
+            if (f->f_name[0])
+                ls1(prefix, f->f_type==FTYPE_DIR, f->f_size, f->f_name);
+        if (n == 0)
+            continue;
+        if ((r = fsring_read(fd, dirbuf[i], sizeof dirbuf[i])) < 0)
+            panic("error reading directory %s: %e", path, r);
+        queued++;
+    }
+    close(fd);
 }
 
     void
@@ -0,0 +1,164 @@
+// Print the network server's counters: lwIP's per-protocol and memory
+// pool counters, and the server's own request, buffer and ring
+// figures.  Given an interval, keep printing what changed over each
+// one, with rates per second.
+//
+// Usage: netstat [interval-secs [count]]
+
+#include <inc/lib.h>
+
+static const char *memp_names[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name, num, size, desc) desc,
+#include <lwip/memp_std.h>
+};
+
+static const char *req_names[NSREQ_NTYPES] = {
+    [NSREQ_ACCEPT] = "accept",
+    [NSREQ_BIND] = "bind",
+    [NSREQ_SHUTDOWN] = "shutdown",
+    [NSREQ_CLOSE] = "close",
+    [NSREQ_CONNECT] = "connect",
+    [NSREQ_LISTEN] = "listen",
+    [NSREQ_RECV] = "recv",
+    [NSREQ_SEND] = "send",
+    [NSREQ_SOCKET] = "socket",
+    [NSREQ_STATS] = "stats",
+    [NSREQ_SENDV] = "sendv",
+    [NSREQ_RECVV] = "recvv",
+    [NSREQ_SENDFILE] = "sendfile",
+    [NSREQ_POLL] = "poll",
+    [NSREQ_INPUT] = "input",
+    [NSREQ_OUTPUT] = "output",
+    [NSREQ_TIMER] = "timer",
+};
+
+#define PROTO(p)	{ #p, offsetof(struct stats_, p) }
+
+static const struct {
+    const char *name;
+    size_t off;
+} protos[] = {
+    PROTO(link), PROTO(etharp), PROTO(ip), PROTO(icmp), PROTO(udp), PROTO(tcp)
+};
+
+static struct Nsret_stats stats[2];
+
+    static struct stats_proto *
+proto(struct Nsret_stats *st, int i)
+{
+    return (struct stats_proto *) ((char *) &st->ret_lwip + protos[i].off);
+}
+
+// Counter c, less its value in prev if there is one.
+#define DELTA(cur, prev, c)	((cur)->c - ((prev) ? (prev)->c : 0))
+
+    static void
+print_protos(struct Nsret_stats *cur, struct Nsret_stats *prev, unsigned ms)
+{
+    struct stats_proto *p, *q;
+    int i;
+
+    cprintf("%-8s %9s %9s %7s %7s %7s %7s %7s", "proto", "xmit", "recv",
+            "drop", "chkerr", "memerr", "err", "rexmit");
+    if (prev)
+        cprintf(" %8s %8s", "xmit/s", "recv/s");
+    cprintf("\n");
+    for (i = 0; i < (int) (sizeof(protos) / sizeof(protos[0])); i++) {
+        p = proto(cur, i);
+        q = prev ? proto(prev, i) : 0;
+        cprintf("%-8s %9u %9u %7u %7u %7u %7u %7u", protos[i].name,
+                DELTA(p, q, xmit), DELTA(p, q, recv), DELTA(p, q, drop),
+                DELTA(p, q, chkerr), DELTA(p, q, memerr), DELTA(p, q, err),
+                DELTA(p, q, rexmit));
+        if (prev)
+            cprintf(" %8u %8u", DELTA(p, q, xmit) * 1000 / ms,
+                    DELTA(p, q, recv) * 1000 / ms);
+        cprintf("\n");
+    }
+}
+
+    static void
+print_pools(struct Nsret_stats *cur, struct Nsret_stats *prev)
+{
+    struct stats_mem *m;
+    int i;
+
+    cprintf("%-16s %6s %6s %6s %7s\n", "pool", "used", "avail", "max", "err");
+    for (i = 0; i < MEMP_MAX; i++) {
+        m = &cur->ret_lwip.memp[i];
+        if (m->avail == 0)
+            continue;
+        cprintf("%-16s %6u %6u %6u %7u\n", memp_names[i], m->used, m->avail,
+                m->max, DELTA(m, prev ? &prev->ret_lwip.memp[i] : 0, err));
+    }
+}
+
+    static void
+print_ns(struct Nsret_stats *cur, struct Nsret_stats *prev, unsigned ms)
+{
+    struct Nsreqstat *r, *s;
+    uint64_t n;
+    int i;
+
+    cprintf("ns: %u/%u buffers busy, %lu refused; "
+            "rings: %u in, %u lent, %u out\n",
+            cur->ret_nbusy, cur->ret_nworkers,
+            (unsigned long) DELTA(cur, prev, ret_nrefused),
+            cur->ret_inring, cur->ret_inlent, cur->ret_outring);
+
+    cprintf("%-8s %10s %10s %10s", "request", "count", "avg cyc", "max cyc");
+    if (prev)
+        cprintf(" %8s", "/s");
+    cprintf("\n");
+    for (i = 0; i < NSREQ_NTYPES; i++) {
+        r = &cur->ret_req[i];
+        s = prev ? &prev->ret_req[i] : 0;
+        if (!(n = DELTA(r, s, rs_count)))
+            continue;
+        cprintf("%-8s %10lu %10lu %10lu", req_names[i] ? req_names[i] : "?",
+                (unsigned long) n,
+                (unsigned long) (DELTA(r, s, rs_cycles) / n),
+                (unsigned long) r->rs_max);
+        if (prev)
+            cprintf(" %8lu", (unsigned long) (n * 1000 / ms));
+        cprintf("\n");
+    }
+}
+
+    static void
+print_stats(struct Nsret_stats *cur, struct Nsret_stats *prev)
+{
+    unsigned ms = prev ? MAX(cur->ret_msec - prev->ret_msec, 1) : 0;
+
+    if (prev)
+        cprintf("--- last %u ms ---\n", ms);
+    print_protos(cur, prev, ms);
+    print_pools(cur, prev);
+    print_ns(cur, prev, ms);
+}
+
+    void
+umain(int argc, char **argv)
+{
+    unsigned interval = 0, count = ~0U, end, i;
+    int r;
+
+    binaryname = "netstat";
+    if (argc > 1)
+        interval = strtol(argv[1], 0, 0);
+    if (argc > 2)
+        count = strtol(argv[2], 0, 0);
+
+    if ((r = nsipc_stats(&stats[0])) < 0)
+        panic("nsipc_stats: %e", r);
+    print_stats(&stats[0], 0);
+
+    for (i = 1; interval && i <= count; i++) {
+        end = sys_time_msec() + interval * 1000;
+        while (sys_time_msec() < end)
+            sys_yield();
+        if ((r = nsipc_stats(&stats[i % 2])) < 0)
+            panic("nsipc_stats: %e", r);
+        print_stats(&stats[i % 2], &stats[(i - 1) % 2]);
+    }
+}
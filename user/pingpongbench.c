@@ -0,0 +1,71 @@
+// Time a pingpong-style IPC loop: two envs bounce a counter back and
+// forth as fast as they can, so nearly every IPC is an env switch.
+// Compare a normal kernel against one built with "make NO_PCID=1",
+// which flushes the whole TLB on each switch.
+//
+// Usage: pingpongbench [round trips]
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define DEFAULT_ROUNDS	20000
+
+// Touch this many pages between messages, so each side has a working
+// set for the TLB to keep (or lose) across switches.
+#define WORKSET_PAGES	32
+
+static uint8_t workset[WORKSET_PAGES * PGSIZE] __attribute__((aligned(PGSIZE)));
+
+    static void
+touch(void)
+{
+    int i;
+
+    for (i = 0; i < WORKSET_PAGES; i++)
+        workset[i * PGSIZE]++;
+}
+
+    void
+umain(int argc, char **argv)
+{
+    envid_t who, from;
+    uint32_t i, rounds = DEFAULT_ROUNDS;
+    unsigned start_ms, ms;
+    uint64_t start_tsc, cycles;
+
+    binaryname = "pingpongbench";
+    if (argc > 1)
+        rounds = strtol(argv[1], 0, 0);
+    if (rounds == 0) {
+        cprintf("usage: pingpongbench [rounds > 0]\n");
+        return;
+    }
+    touch();
+
+    if ((who = fork()) < 0)
+        panic("fork: %e", who);
+    if (who == 0) {
+        // Echo each value back until told to stop.
+        while (1) {
+            i = ipc_recv(&from, 0, 0);
+            touch();
+            ipc_send(from, i, 0, 0);
+            if (i == rounds)
+                return;
+        }
+    }
+
+    start_ms = sys_time_msec();
+    start_tsc = read_tsc();
+    for (i = 1; i <= rounds; i++) {
+        ipc_send(who, i, 0, 0);
+        if (ipc_recv(&from, 0, 0) != i)
+            panic("pingpongbench: lost count at %d", i);
+        touch();
+    }
+    cycles = read_tsc() - start_tsc;
+    ms = sys_time_msec() - start_ms;
+
+    cprintf("pingpongbench: %d round trips in %d ms, %ld cycles each\n",
+            rounds, ms, (long) (cycles / rounds));
+}
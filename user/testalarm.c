@@ -0,0 +1,98 @@
+// Test sys_ipc_alarm: arming, disarming and re-arming, an alarm that is
+// already due when we start receiving, a message from another env while
+// an alarm is armed, and an env that exits with an alarm armed.
+
+#include <inc/lib.h>
+
+// Receive one message and check it is our alarm carrying value, no
+// earlier than deadline.
+    static void
+expect_alarm(uint32_t value, unsigned deadline)
+{
+    envid_t from;
+    uint32_t v;
+
+    v = ipc_recv(&from, 0, 0);
+    if (from != thisenv->env_id)
+        panic("expected alarm %d, got %d from %08x", value, v, from);
+    if (v != value)
+        panic("alarm carried %d, want %d", v, value);
+    if ((int) (sys_time_msec() - deadline) < 0)
+        panic("alarm %d came %d ms early", value, deadline - sys_time_msec());
+}
+
+    static unsigned
+arm(unsigned msec, uint32_t value)
+{
+    unsigned deadline = MAX(sys_time_msec() + msec, 1);
+    int r;
+
+    if ((r = sys_ipc_alarm(deadline, value)) < 0)
+        panic("sys_ipc_alarm: %e", r);
+    return deadline;
+}
+
+    void
+umain(int argc, char **argv)
+{
+    unsigned deadline;
+    envid_t parent, child, from;
+    uint32_t v;
+    int i, r;
+
+    binaryname = "testalarm";
+
+    // A disarmed alarm never fires: the next one to arrive is the one
+    // armed after it.
+    arm(20, 1);
+    if ((r = sys_ipc_alarm(0, 0)) < 0)
+        panic("sys_ipc_alarm disarm: %e", r);
+    deadline = arm(100, 2);
+    expect_alarm(2, deadline);
+    cprintf("alarm disarm is good\n");
+
+    // Re-arming replaces the alarm, whether earlier or later.
+    arm(200, 3);
+    deadline = arm(40, 4);
+    expect_alarm(4, deadline);
+    arm(10, 5);
+    deadline = arm(80, 6);
+    expect_alarm(6, deadline);
+    cprintf("alarm re-arm is good\n");
+
+    // An alarm that is already due is delivered as soon as we receive.
+    deadline = arm(0, 7);
+    for (i = 0; i < 20; i++)
+        sys_yield();
+    expect_alarm(7, deadline);
+    cprintf("alarm already due is good\n");
+
+    // A message from someone else comes through as usual, and the alarm
+    // still fires afterwards.
+    parent = thisenv->env_id;
+    deadline = arm(100, 8);
+    if ((child = fork()) < 0)
+        panic("fork: %e", child);
+    if (child == 0) {
+        ipc_send(parent, 9, 0, 0);
+        exit();
+    }
+    v = ipc_recv(&from, 0, 0);
+    if (from != child || v != 9)
+        panic("got %d from %08x, want 9 from %08x", v, from, child);
+    expect_alarm(8, deadline);
+    cprintf("alarm with other messages is good\n");
+
+    // A child that exits with an alarm armed takes it along; the kernel
+    // checks its count of armed alarms on every tick.
+    if ((child = fork()) < 0)
+        panic("fork: %e", child);
+    if (child == 0) {
+        arm(50, 10);
+        exit();
+    }
+    wait(child);
+    deadline = arm(100, 11);
+    expect_alarm(11, deadline);
+    cprintf("alarm on exit is good\n");
+}
@@ -4,6 +4,8 @@ const char *msg = "This is the NEW message of the day!\n\n";
 
 #define FVA ((struct Fd*)0xCCCCC000)
 
+static char bigbuf[FSRING_NENT][512];
+
     static int
 xopen(const char *path, int mode)
 {
@@ -26,6 +28,7 @@ umain(int argc, char **argv)
     struct Fd fdcopy;
     struct Stat st;
     char buf[512];
+    int t0, t;
 
     // We open files manually first, to avoid the FD layer
     if ((r = xopen("/not-found", O_RDONLY)) < 0 && r != -E_NOT_FOUND)
@@ -124,5 +127,50 @@ umain(int argc, char **argv)
     }
     close(f);
     cprintf("large file is good\n");
+
+    // Queue a stat and a run of reads on the ring before reaping any,
+    // then check they come back in order.
+    if ((f = open("/big", O_RDONLY)) < 0)
+        panic("open /big: %e", f);
+    if ((r = fsring_stat(f, &st)) < 0)
+        panic("fsring_stat: %e", r);
+    for (i = 0; i < FSRING_NENT - 1; i++)
+        if ((r = fsring_read(f, bigbuf[i], sizeof(bigbuf[i]))) < 0)
+            panic("fsring_read %d: %e", i, r);
+    if ((r = fsring_read(f, buf, sizeof(buf))) != -E_NO_MEM)
+        panic("fsring_read on a full ring: %e", r);
+    if ((r = fsring_reap(&t0)) < 0)
+        panic("fsring_reap stat: %e", r);
+    if (st.st_size != (NDIRECT*3)*BLKSIZE || strcmp(st.st_name, "big") != 0)
+        panic("fsring_stat returned %s size %d", st.st_name, st.st_size);
+    for (i = 0; i < FSRING_NENT - 1; i++) {
+        if ((r = fsring_reap(&t)) != sizeof(bigbuf[i]))
+            panic("fsring_reap read %d: %e", i, r);
+        if (t != t0 + 1 + i)
+            panic("fsring_reap read %d: ticket %d, want %d", i, t, t0 + 1 + i);
+        if (*(int*)bigbuf[i] != i * sizeof(bigbuf[i]))
+            panic("fsring_read %d returned bad data %d", i, *(int*)bigbuf[i]);
+    }
+    if ((r = fsring_reap(&t)) != -E_INVAL)
+        panic("fsring_reap on an empty ring: %e", r);
+
+    // Fork must leave the ring shared with the file server: the parent
+    // keeps using it, and the child sets up one of its own.
+    if ((r = fork()) < 0)
+        panic("fork: %e", r);
+    if (r == 0) {
+        if ((r = fsring_stat(f, &st)) < 0 || (r = fsring_reap(0)) < 0)
+            panic("fsring_stat in child: %e", r);
+        exit();
+    }
+    wait(r);
+    if ((r = fsring_read(f, buf, sizeof(buf))) < 0)
+        panic("fsring_read after fork: %e", r);
+    if ((r = fsring_reap(0)) != sizeof(buf))
+        panic("fsring_reap after fork: %e", r);
+    if (*(int*)buf != (FSRING_NENT - 1) * sizeof(buf))
+        panic("fsring_read after fork returned bad data %d", *(int*)buf);
+    close(f);
+    cprintf("file ring is good\n");
 }
 